@@ -0,0 +1,50 @@
+/******************************************************************************
+*
+* CAEN SpA - Front End Division
+* Via Vetraia, 11 - 55049 - Viareggio ITALY
+* +390594388398 - www.caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This program is free software; you can redistribute it and/or modify it under
+* the terms of the GNU General Public License as published by the Free Software
+* Foundation. This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#ifndef _BLTSIZE_H
+#define _BLTSIZE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "BufferPool.h"
+
+#define BLT_MIN_SIZE_DEFAULT	256		// bytes (about two events of a 16 channel board)
+#define BLT_SIZE_ALIGN			8		// MBLT transfers are made of 64 bit words
+
+//****************************************************************************
+// Block transfer size controller
+//****************************************************************************
+typedef struct {
+	int Adaptive;					// 0 = always request MaxSize
+	int MinSize;					// smallest request (bytes)
+	int MaxSize;					// largest request (bytes, size of the readout buffer)
+	int CurSize;					// size of the next request
+	double AvgBytes;				// moving average of the bytes returned by the board
+	uint64_t NumTransfers;			// statistics
+	uint64_t NumTruncated;			// transfers that filled the whole request
+} BltSizer;
+
+//****************************************************************************
+// Function prototypes
+//****************************************************************************
+void BltSizer_Init(BltSizer *bs, int MinSize, int MaxSize, int Adaptive);
+int BltSizer_NeedsStatus(BltSizer *bs, int bcnt);
+void BltSizer_Update(BltSizer *bs, int bcnt, int BoardFull);
+int CountEvents(uint32_t *buffer, int nw);
+int BltSweep(int32_t handle, uint32_t BaseAddress, BufPool *pool, int MinSize, int StepTime, FILE *fout, int (*StopReq)(void));
+
+#endif
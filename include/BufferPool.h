@@ -0,0 +1,76 @@
+/******************************************************************************
+*
+* CAEN SpA - Front End Division
+* Via Vetraia, 11 - 55049 - Viareggio ITALY
+* +390594388398 - www.caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This program is free software; you can redistribute it and/or modify it under
+* the terms of the GNU General Public License as published by the Free Software
+* Foundation. This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#ifndef _BUFFERPOOL_H
+#define _BUFFERPOOL_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define BUFPOOL_DEFAULT_COUNT		8
+#define BUFPOOL_DEFAULT_SIZE		(256*1024)
+
+struct BufPool;
+
+//****************************************************************************
+// Readout block: one page aligned buffer lent by the pool to the readout
+// path. The block goes back to the free list when the last consumer that
+// holds a reference calls BufPool_Release.
+//****************************************************************************
+typedef struct BufPool_Block {
+	uint32_t *data;					// page aligned buffer (raw data from the board)
+	int size;						// size of the buffer in bytes
+	int nbytes;						// number of valid bytes (set by the readout)
+	uint64_t TimeStamp;				// read completion time (ns from the start of the run)
+	int index;						// position of the block inside the pool
+	volatile int refcnt;			// number of consumers holding the block
+	struct BufPool *pool;			// owner
+} BufPool_Block;
+
+//****************************************************************************
+// Buffer Pool
+//****************************************************************************
+typedef struct BufPool {
+	BufPool_Block *blocks;
+	int NumBlocks;					// number of blocks in the pool
+	int BlockSize;					// size of each block in bytes (multiple of the page size)
+	int *FreeList;					// stack of the free block indexes
+	int NumFree;
+	pthread_mutex_t lock;
+	void *mem;						// memory area shared by all the blocks
+	size_t MemSize;
+	int HugePages;					// 1 if the memory is backed by huge pages
+	int Locked;						// 1 if the memory is locked in RAM (mlock)
+	// statistics
+	uint64_t hits;					// requests served from the free list
+	uint64_t misses;				// requests failed because the pool was exhausted
+	uint64_t returns;				// blocks given back to the pool
+	int MinFree;					// low water mark of the free list
+} BufPool;
+
+//****************************************************************************
+// Function prototypes
+//****************************************************************************
+int BufPool_Init(BufPool *pool, int NumBlocks, int BlockSize, int UseHugePages, int LockMemory);
+BufPool_Block *BufPool_Get(BufPool *pool);
+void BufPool_Retain(BufPool_Block *blk);
+void BufPool_Release(BufPool_Block *blk);
+int BufPool_NumFree(BufPool *pool);
+void BufPool_PrintStats(BufPool *pool, FILE *f);
+void BufPool_Close(BufPool *pool);
+
+#endif
@@ -0,0 +1,69 @@
+/******************************************************************************
+*
+* CAEN SpA - Front End Division
+* Via Vetraia, 11 - 55049 - Viareggio ITALY
+* +390594388398 - www.caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This program is free software; you can redistribute it and/or modify it under
+* the terms of the GNU General Public License as published by the Free Software
+* Foundation. This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#ifndef _CALIB_H
+#define _CALIB_H
+
+#include <stdint.h>
+#include <time.h>
+
+#define CALIB_MAX_CH		32
+
+//****************************************************************************
+// Calibration table: phys = (adc - Ped) * Gain + Offset, precomputed for
+// every ADC value as the bin of the calibrated histogram.
+// Bin == NumBins means out of range (under/overflow bin).
+//****************************************************************************
+typedef struct {
+	float Ped[CALIB_MAX_CH];
+	float Gain[CALIB_MAX_CH];
+	float Offset[CALIB_MAX_CH];
+	uint16_t Bin[CALIB_MAX_CH][4096];
+} CalTable;
+
+typedef struct {
+	int NumCh;
+	int NumBins;					// bins of the calibrated histograms
+	double Min, Max;				// range of the calibrated histograms (physical units)
+	CalTable *volatile Active;		// table used by the fill path
+	CalTable *Retired;				// table replaced by the last load (see Calib_FreeRetired)
+	uint64_t *CalHisto;				// NumCh x (NumBins+1) counters
+	char FileName[255];				// calibration file ("" = default tables)
+	time_t FileTime;				// modification time of the loaded file
+	int NumLoads;
+} Calib;
+
+//****************************************************************************
+// Fill the calibrated histogram of channel ch with one ADC value
+//****************************************************************************
+static inline void Calib_Fill(Calib *cal, int ch, int adc)
+{
+	CalTable *tab = __atomic_load_n(&cal->Active, __ATOMIC_ACQUIRE);  // see Calib_Load
+	cal->CalHisto[ch * (cal->NumBins + 1) + tab->Bin[ch][adc & 0xFFF]]++;
+}
+
+//****************************************************************************
+// Function prototypes
+//****************************************************************************
+int Calib_Init(Calib *cal, int NumCh, int NumBins, double Min, double Max, double DefaultGain);
+int Calib_Load(Calib *cal, const char *FileName);
+int Calib_CheckReload(Calib *cal);
+void Calib_FreeRetired(Calib *cal);
+void Calib_Reset(Calib *cal);
+int Calib_Save(Calib *cal, const char *DataPath);
+void Calib_Close(Calib *cal);
+
+#endif
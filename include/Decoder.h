@@ -0,0 +1,95 @@
+/******************************************************************************
+*
+* CAEN SpA - Front End Division
+* Via Vetraia, 11 - 55049 - Viareggio ITALY
+* +390594388398 - www.caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This program is free software; you can redistribute it and/or modify it under
+* the terms of the GNU General Public License as published by the Free Software
+* Foundation. This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#ifndef _DECODER_H
+#define _DECODER_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define DATATYPE_MASK		0x06000000
+#define DATATYPE_HEADER		0x02000000
+#define DATATYPE_CHDATA		0x00000000
+#define DATATYPE_EOB		0x04000000
+#define DATATYPE_FILLER		0x06000000
+
+#define QTP_MAX_CH			32
+#define QTP_NO_DATA			0xFFFF	// value of the channels not present in the event
+
+#define QTP_OV_BIT			(1<<12)	// overflow
+#define QTP_UN_BIT			(1<<13)	// under threshold
+#define QTP_V_BIT			(1<<14)	// valid data
+
+//****************************************************************************
+// Decoded event
+//****************************************************************************
+typedef struct {
+	uint32_t EventNum;				// event counter (from the EOB)
+	uint32_t ChMask;				// channels present in the event
+	uint32_t UnMask;				// channels with the under threshold bit set
+	uint32_t OvMask;				// channels with the overflow bit set
+	uint32_t VMask;					// channels with the valid bit set
+	uint32_t Header;				// header word (GEO, crate, channel count)
+	uint64_t TimeStamp;				// ns from the start of the run
+	uint16_t Data[QTP_MAX_CH];		// ADC values (QTP_NO_DATA if not present)
+} QTP_Event;
+
+//****************************************************************************
+// Decoder state (events can be split across two blocks)
+//****************************************************************************
+typedef struct {
+	int NumCh;						// channels of the board (16 or 32)
+	int DataType;					// type of the next expected word
+	int nch;						// channels declared by the header of the current event
+	int chindex;					// channels read so far in the current event
+	int Error;						// set when the data stream is corrupted
+	QTP_Event Cur;					// event being decoded
+	// time stamp interpolation over the current block
+	uint64_t BlockStart;			// time of the previous block
+	uint64_t BlockDt;				// time elapsed since the previous block
+	int NevInBlock;					// headers in the current block
+	int EvInBlock;					// headers found so far
+} Decoder;
+
+//****************************************************************************
+// Software zero and overflow suppression: a channel is kept if its value is
+// not below the threshold of the channel and the under threshold bit (and,
+// unless KeepOverflow is set, the overflow bit) is clear. The events left
+// without channels are dropped.
+//****************************************************************************
+typedef struct {
+	int Enabled;
+	uint32_t OvDrop;				// 0xFFFFFFFF = drop the overflows, 0 = keep them
+	uint32_t Thr[QTP_MAX_CH] __attribute__((aligned(64)));	// lowest value kept
+	uint64_t ChKept, ChDropped;
+	uint64_t EvDropped;
+} Suppressor;
+
+//****************************************************************************
+// Function prototypes
+//****************************************************************************
+void Decoder_Init(Decoder *dec, int NumCh);
+void Decoder_Reset(Decoder *dec);
+void Decoder_SetBlockTime(Decoder *dec, uint64_t PrevBlockTime, uint64_t BlockTime, int NevInBlock);
+int Decoder_DecodeBlock(Decoder *dec, const uint32_t *buffer, int nw, QTP_Event *ev, int MaxEv);
+
+void Suppressor_Init(Suppressor *sup, int Enabled, const uint16_t *Thr, int KeepOverflow);
+int Decoder_Suppress(Suppressor *sup, const QTP_Event *in, QTP_Event *out, int nev);
+void Suppressor_Reset(Suppressor *sup);
+void Suppressor_PrintStats(Suppressor *sup, FILE *f);
+int Decoder_PrintEvent(FILE *f, const QTP_Event *ev, int Board, int TimeStamps);
+
+#endif
@@ -0,0 +1,64 @@
+/******************************************************************************
+*
+* CAEN SpA - Front End Division
+* Via Vetraia, 11 - 55049 - Viareggio ITALY
+* +390594388398 - www.caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This program is free software; you can redistribute it and/or modify it under
+* the terms of the GNU General Public License as published by the Free Software
+* Foundation. This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#ifndef _FILTER_H
+#define _FILTER_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "Decoder.h"
+
+//****************************************************************************
+// Selection settings (as read from the config file)
+//****************************************************************************
+typedef struct {
+	uint32_t CoincMask;				// channels of the coincidence
+	int CoincMin;					// min number of channels of CoincMask in the event (0 = all)
+	uint32_t WindowMask;			// channels with a value window
+	uint16_t WinLow[QTP_MAX_CH];	// value windows (inclusive)
+	uint16_t WinHigh[QTP_MAX_CH];
+	int MultMin, MultMax;			// multiplicity cut (channels in the event)
+	int MultSet;
+} FilterCfg;
+
+//****************************************************************************
+// Compiled predicate: every event is evaluated with the same sequence of
+// mask, compare and popcount operations, without data dependent branches.
+//****************************************************************************
+typedef struct {
+	int Enabled;
+	uint32_t CoincMask;
+	uint32_t CoincMin;
+	uint32_t WindowMask;
+	uint32_t WinLow[QTP_MAX_CH] __attribute__((aligned(64)));
+	uint32_t WinSpan[QTP_MAX_CH] __attribute__((aligned(64)));	// high - low (unsigned compare trick)
+	uint32_t MultMin, MultSpan;
+	uint64_t Accepted, Rejected;
+} Filter;
+
+//****************************************************************************
+// Function prototypes
+//****************************************************************************
+void FilterCfg_Init(FilterCfg *cfg);
+int FilterCfg_Parse(FilterCfg *cfg, const char *key, FILE *f_ini);
+void Filter_Compile(Filter *flt, const FilterCfg *cfg);
+int Filter_Batch(Filter *flt, const QTP_Event *ev, int nev, int *sel);
+void Filter_Reset(Filter *flt);
+void Filter_PrintStats(Filter *flt, FILE *f);
+int EncodeEvent(const QTP_Event *ev, int NumCh, uint32_t *words);
+
+#endif
@@ -0,0 +1,67 @@
+/******************************************************************************
+*
+* CAEN SpA - Front End Division
+* Via Vetraia, 11 - 55049 - Viareggio ITALY
+* +390594388398 - www.caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This program is free software; you can redistribute it and/or modify it under
+* the terms of the GNU General Public License as published by the Free Software
+* Foundation. This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#ifndef _HIST2D_H
+#define _HIST2D_H
+
+#include <stdint.h>
+
+#include "Decoder.h"
+
+#define HIST2D_MAX_PAIRS		8
+#define HIST2D_TILE_BITS		5							// tiles of 32 x 32 bins (4 KB)
+#define HIST2D_TILE_SIZE		(1 << HIST2D_TILE_BITS)
+#define HIST2D_TILE_BINS		(HIST2D_TILE_SIZE * HIST2D_TILE_SIZE)
+#define HIST2D_PROMOTE_HITS		64							// hits that move a region from the sparse map to a tile
+#define HIST2D_SPARSE_SIZE		16384						// entries of the sparse map (power of 2)
+
+//****************************************************************************
+// Channel vs channel histogram. The plane is divided in tiles that are
+// allocated (from a preallocated arena) when a region gets enough hits;
+// rarely hit regions are counted in a small sparse hash map.
+//****************************************************************************
+typedef struct {
+	int ChX, ChY;					// channel pair
+	int Bins;						// bins per axis (power of 2, <= 4096)
+	int Shift;						// 4096 >> Shift = Bins
+	int TilesPerAxis;
+	uint32_t **Tile;				// tile directory (NULL = region in the sparse map)
+	uint32_t *TileHits;				// sparse hits of each region (for the promotion)
+	uint32_t *Arena;				// memory of the tiles
+	int NumTiles, MaxTiles;
+	uint32_t *SparseKey;			// bin index + 1 (0 = empty)
+	uint32_t *SparseVal;
+	int SparseUsed;
+	uint32_t *Scratch;				// work area for the rebuild of the sparse map
+	uint64_t Entries;
+	uint64_t Lost;					// fills lost because both the arena and the map were full
+} Hist2D;
+
+typedef struct {
+	int NumPairs;
+	Hist2D h[HIST2D_MAX_PAIRS];
+} Hist2DSet;
+
+//****************************************************************************
+// Function prototypes
+//****************************************************************************
+int Hist2D_Add(Hist2DSet *set, int ChX, int ChY, int Bins, int MaxTiles);
+void Hist2D_FillEvents(Hist2DSet *set, const QTP_Event *ev, int nev);
+void Hist2D_Reset(Hist2DSet *set);
+int Hist2D_Save(Hist2DSet *set, const char *DataPath);
+void Hist2D_Close(Hist2DSet *set);
+
+#endif
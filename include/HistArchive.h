@@ -0,0 +1,113 @@
+/******************************************************************************
+*
+* CAEN SpA - Front End Division
+* Via Vetraia, 11 - 55049 - Viareggio ITALY
+* +390594388398 - www.caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This program is free software; you can redistribute it and/or modify it under
+* the terms of the GNU General Public License as published by the Free Software
+* Foundation. This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#ifndef _HISTARCHIVE_H
+#define _HISTARCHIVE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "Histo.h"
+
+#define HARCH_MAX_CH			32
+#define HARCH_BINS				HISTO_MAX_BINS	// max bins per channel
+#define HARCH_MAGIC				0x48435241		// "ARCH"
+#define HARCH_SLICE_MAGIC		0x45434C53		// "SLCE"
+#define HARCH_VERSION			1
+
+//****************************************************************************
+// Time-sliced histogram archive: every Interval the content of the
+// histograms accumulated since the previous slice is appended to the data
+// file (<name>.dat) and an entry is appended to the index file (<name>.idx).
+//
+// Data file: HArch_FileHeader, then one record per slice made of a copy of
+// its index entry followed, for each channel, by the number of non empty
+// bins and by the (bin - previous bin, counts) pairs of those bins, all as
+// LEB128 varints (bin starts from -1).
+// Index file: HArch_FileHeader, then one HArch_Index per slice, in time
+// order (fixed size: the slices of a time range are found by bisection).
+//
+// The writer keeps only the snapshot of the histograms at the last slice,
+// so the memory does not depend on the length of the run.
+//****************************************************************************
+typedef struct {
+	uint32_t Magic;
+	uint16_t Version;
+	uint16_t NumCh;
+	uint32_t Bins;
+	uint32_t Interval;				// ms
+	int64_t WallStart;				// start of the archive (s since the epoch)
+} HArch_FileHeader;
+
+typedef struct {
+	uint32_t Magic;					// HARCH_SLICE_MAGIC
+	uint32_t Slice;					// slice number
+	uint64_t TStart;				// ns from the start of the archive
+	uint64_t TEnd;
+	int64_t WallTime;				// end of the slice (s since the epoch)
+	uint64_t Offset;				// position of the record in the data file
+	uint32_t Size;					// bytes of the record (with this entry)
+	uint32_t Segment;				// run segment
+	uint64_t Counts;				// counts of all the channels
+} HArch_Index;
+
+//****************************************************************************
+// Writer
+//****************************************************************************
+typedef struct {
+	int Enabled;
+	int NumCh;
+	int Bins;
+	uint64_t Interval;				// ns
+	uint64_t T0;					// time (Timer_Now) of the start of the archive
+	uint64_t SliceStart;			// ns from T0
+	uint32_t NumSlices;
+	uint32_t *Prev;					// histograms at the end of the last slice (NumCh x Bins)
+	uint8_t *Buf;					// encoding of a channel
+	FILE *fdat, *fidx;
+	uint64_t DatSize;
+	uint64_t BytesWritten;
+} HistArchive;
+
+//****************************************************************************
+// Reader
+//****************************************************************************
+typedef struct {
+	HArch_FileHeader Hdr;
+	FILE *fdat, *fidx;
+	uint32_t NumSlices;
+	uint8_t *Buf;
+	uint32_t BufSize;
+} HArchReader;
+
+//****************************************************************************
+// Function prototypes
+//****************************************************************************
+int HistArchive_Open(HistArchive *ha, const char *FileName, int NumCh, int Bins, int IntervalMs, uint64_t Now);
+int HistArchive_Due(HistArchive *ha, uint64_t Now);
+int HistArchive_Update(HistArchive *ha, const HistoSet *histo, uint64_t Now, int Segment);
+void HistArchive_Reset(HistArchive *ha);
+void HistArchive_PrintStats(HistArchive *ha, FILE *f);
+void HistArchive_Close(HistArchive *ha);
+
+int HArchReader_Open(HArchReader *rd, const char *FileName);
+int HArchReader_GetIndex(HArchReader *rd, uint32_t slice, HArch_Index *ix);
+uint32_t HArchReader_Find(HArchReader *rd, uint64_t t);
+int HArchReader_Add(HArchReader *rd, uint32_t slice, uint32_t (*histo)[HARCH_BINS]);
+int HArchReader_Sum(HArchReader *rd, uint64_t t0, uint64_t t1, uint32_t (*histo)[HARCH_BINS], HArch_Index *range);
+void HArchReader_Close(HArchReader *rd);
+
+#endif
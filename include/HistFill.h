@@ -0,0 +1,96 @@
+/******************************************************************************
+*
+* CAEN SpA - Front End Division
+* Via Vetraia, 11 - 55049 - Viareggio ITALY
+* +390594388398 - www.caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This program is free software; you can redistribute it and/or modify it under
+* the terms of the GNU General Public License as published by the Free Software
+* Foundation. This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#ifndef _HISTFILL_H
+#define _HISTFILL_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "Decoder.h"
+#include "BufferPool.h"
+#include "Calib.h"
+#include "Histo.h"
+
+#define HF_MAX_WORKERS		16
+#define HF_RING_SIZE		8		// batches queued to each worker
+#define HF_CACHE_LINE		64
+
+//****************************************************************************
+// Batch of events queued to a worker: the events are not copied, the batch
+// holds a reference to the readout block they were decoded from
+//****************************************************************************
+typedef struct {
+	const QTP_Event *ev;
+	int nev;
+	BufPool_Block *blk;				// released by the worker after the fill
+	unsigned Epoch;					// reset epoch at the time the batch was decoded
+} HF_Batch;
+
+//****************************************************************************
+// Fill worker: private histogram shard (NumCh rows of Bins 32 bit counters,
+// read by the merger while they are filled) and single producer / single
+// consumer ring of batches. Producer and consumer indexes sit on separate
+// cache lines. The merger adds to the HistoSet the increments of the
+// counters since the previous merge (modulo 2^32, like the carries of Lo
+// into Hi), so the shards can wrap.
+//****************************************************************************
+typedef struct HF_Worker {
+	// shard (written only by the worker)
+	uint32_t *histo;
+	uint32_t *CalHisto;
+	uint32_t ns[QTP_MAX_CH];
+	volatile unsigned Epoch;		// reset epoch of the shard contents
+	uint64_t NumEvents;
+	// ring
+	HF_Batch slot[HF_RING_SIZE];
+	volatile unsigned head __attribute__((aligned(HF_CACHE_LINE)));	// written by the acquisition thread
+	volatile unsigned tail __attribute__((aligned(HF_CACHE_LINE)));	// written by the worker
+	pthread_t thread;
+	struct HistFill *hf;
+	// shard values at the previous merge (used only by the merger)
+	uint32_t *Seen;
+	uint32_t *CalSeen;
+	uint32_t NsSeen[QTP_MAX_CH];
+	unsigned SeenEpoch;
+} __attribute__((aligned(HF_CACHE_LINE))) HF_Worker;
+
+typedef struct HistFill {
+	int NumWorkers;
+	int NumCh;
+	int Bins;						// bins per channel (as in the merged HistoSet)
+	int Shift;						// ADC value >> Shift = bin
+	int Stride;						// counters between the rows of the shards (Bins + one cache line)
+	uint64_t *Row;					// increments of a shard row since the previous merge
+	Calib *cal;						// calibrated histograms (NULL = disabled)
+	HF_Worker *w[HF_MAX_WORKERS];
+	volatile unsigned Epoch;		// incremented at each reset
+	volatile int Quit;
+	int next;						// round robin
+} HistFill;
+
+//****************************************************************************
+// Function prototypes
+//****************************************************************************
+int HistFill_Init(HistFill *hf, int NumWorkers, int NumCh, int Bins, Calib *cal);
+void HistFill_Submit(HistFill *hf, const QTP_Event *ev, int nev, BufPool_Block *blk);
+void HistFill_Reset(HistFill *hf);
+void HistFill_Merge(HistFill *hf, HistoSet *histo, int *ns);
+void HistFill_Flush(HistFill *hf);
+void HistFill_Sync(HistFill *hf);
+void HistFill_Close(HistFill *hf);
+
+#endif
@@ -0,0 +1,88 @@
+/******************************************************************************
+*
+* CAEN SpA - Front End Division
+* Via Vetraia, 11 - 55049 - Viareggio ITALY
+* +390594388398 - www.caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This program is free software; you can redistribute it and/or modify it under
+* the terms of the GNU General Public License as published by the Free Software
+* Foundation. This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#ifndef _HISTO_H
+#define _HISTO_H
+
+#include <stdint.h>
+
+#include "Decoder.h"
+
+#define HISTO_MAX_BINS			4096		// 12 bit ADC
+#define HISTO_ALIGN				64
+#define HISTO_ROW_PAD			(HISTO_ALIGN / 2)	// counters between two rows (the rows of the channels
+													// must not sit at the same 4 KB offsets)
+
+//****************************************************************************
+// 1D histograms of a board: NumCh channels (from the board model) of Bins
+// bins each (the 12 bit ADC range rebinned by 4096/Bins).
+// The counters are 16 bit, in one block (16 ch x 4096 bins = 128 KB): when a
+// bin wraps, the carry goes to a row of 32 bit high words allocated for
+// that channel at its first overflow, so the counts are 48 bit and the
+// fill touches the high words only once every 65536 counts.
+//****************************************************************************
+typedef struct {
+	int NumCh;
+	int Bins;						// power of 2, <= HISTO_MAX_BINS
+	int Shift;						// ADC value >> Shift = bin
+	uint16_t *Lo;					// low 16 bits of the counters (NumCh x Bins)
+	uint16_t *Row[QTP_MAX_CH];		// Lo + ch * (Bins + HISTO_ROW_PAD)
+	uint32_t *Hi[QTP_MAX_CH];		// high 32 bits (allocated at the first overflow of the channel)
+	uint32_t WideMask;				// channels with high words in use
+	uint64_t Overflows;
+	uint64_t Lost;					// carries lost because the high words could not be allocated
+} HistoSet;
+
+//****************************************************************************
+// Function prototypes
+//****************************************************************************
+int Histo_Init(HistoSet *h, int NumCh, int Bins);
+void Histo_Carry(HistoSet *h, int ch, int bin);
+void Histo_FillEvents(HistoSet *h, const QTP_Event *ev, int nev, int *ns);
+void Histo_Reset(HistoSet *h);
+void Histo_AddRow(HistoSet *h, int ch, const uint64_t *counts);
+void Histo_Snapshot(const HistoSet *h, int ch, uint32_t *out);
+int Histo_Save(const HistoSet *h, int ch, const char *FileName);
+void Histo_Close(HistoSet *h);
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: add one count to the bin of an ADC value
+// ---------------------------------------------------------------------------------------------------------
+static inline void Histo_Fill(HistoSet *h, int ch, int value)
+{
+	int bin = (value & (HISTO_MAX_BINS - 1)) >> h->Shift;
+
+	if (__builtin_expect(++h->Row[ch][bin] == 0, 0))
+		Histo_Carry(h, ch, bin);
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: counts of a bin / of the bin of an ADC value
+// ---------------------------------------------------------------------------------------------------------
+static inline uint64_t Histo_GetBin(const HistoSet *h, int ch, int bin)
+{
+	uint64_t c = h->Row[ch][bin];
+	if (h->WideMask & (1u << ch))
+		c += (uint64_t)h->Hi[ch][bin] << 16;
+	return c;
+}
+
+static inline uint64_t Histo_Get(const HistoSet *h, int ch, int value)
+{
+	return Histo_GetBin(h, ch, (value & (HISTO_MAX_BINS - 1)) >> h->Shift);
+}
+
+#endif
@@ -0,0 +1,338 @@
+/******************************************************************************
+*
+* CAEN SpA - Front End Division
+* Via Vetraia, 11 - 55049 - Viareggio ITALY
+* +390594388398 - www.caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This program is free software; you can redistribute it and/or modify it under
+* the terms of the GNU General Public License as published by the Free Software
+* Foundation. This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+/*******************************************************************************
+libqtpd: board setup, readout, decoding and histogramming of a QTP board
+(with an optional discriminator), usable in-process by other programs.
+
+Each VME link (CONNECTION section of the config file) has its own QTP board
+(QTPD_Board). With more than one link, or when a link is pinned to a core,
+every link is read by its own thread; the decoded blocks of all the links
+are merged in a queue and the histograms, statistics and outputs are
+processed by the thread that calls QTPD_Read (or runs the callback).
+
+Typical use:
+	QTPD_ConfigDefault(&cfg);
+	QTPD_ConfigLoad(&cfg, "config.txt");	// or set the fields of cfg
+	QTPD_Open(&q, &cfg);					// open the links, probe the boards
+	QTPD_Configure(&q);						// program the boards
+	QTPD_Start(&q);
+	while (...) {							// pull interface
+		const QTPD_View *v = QTPD_Read(&q);
+		if (v == NULL) continue;
+		... v->ev[0 .. v->nev-1] ...
+		QTPD_Release(v);
+	}
+	QTPD_Stop(&q);
+	QTPD_Close(&q);
+
+QTPD_Reconfigure applies the changes of the board settings (pedestal, LLD,
+suppression, discriminator) between QTPD_Stop and QTPD_Start, writing only the
+registers that differ from the image of the last programming: the links, the
+buffers and the histograms stay allocated and the next QTPD_Start begins a new
+run segment.
+
+With HistoArchiveInterval set, the counts added to the histograms of each
+board are appended every interval to a time-sliced archive (HistArchive.h),
+read back by QTPD_Archive.
+
+With QTPD_SetCallback the readout runs in a thread started by QTPD_Start and
+the callback receives each view; the view is released when the callback
+returns, unless the callback keeps it with QTPD_Retain.
+A view points to the readout buffer and to the events decoded from it: both
+stay valid (and read-only) until the view is released.
+*******************************************************************************/
+
+#ifndef _QTPD_H
+#define _QTPD_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include <CAENVMEtypes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "BufferPool.h"
+#include "BltSize.h"
+#include "Timer.h"
+#include "Stats.h"
+#include "Histo.h"
+#include "Calib.h"
+#include "Decoder.h"
+#include "Hist2D.h"
+#include "Filter.h"
+#include "HistFill.h"
+#include "Stream.h"
+#include "HistArchive.h"
+
+#define QTPD_LSB2PHY			100		// LSB (= ADC count) to Physical Quantity (time in ps, charge in fC, amplitude in mV)
+#define QTPD_MAX_LINKS			8
+#define QTPD_MAX_MULTI			32		// max registers of a multiple cycle (longer lists of QTPD_ReadRegs/QTPD_WriteRegs are split)
+
+// Discriminator threshold scan (DiscrScanMode)
+#define DISCR_SCAN_ALL			1		// all the channels together
+#define DISCR_SCAN_EACH			2		// each enabled channel alone
+
+//****************************************************************************
+// Settings of a VME link (CONNECTION section of the config file)
+//****************************************************************************
+typedef struct {
+	CVBoardTypes LinkType;
+	int LinkPid;					// link number (PID of the V4718 and A4818 USB bridges)
+	char LinkIp[24];				// IP address of the ethernet bridges
+	int ConetNode;					// node in the optical daisy chain (0 for the direct links)
+	// Base addresses (0 = board not present)
+	uint32_t QTPBaseAddr;
+	uint32_t DiscrBaseAddr;
+	int Core;						// CPU core of the readout thread (-1 = not pinned)
+} QTPD_LinkConfig;
+
+//****************************************************************************
+// Settings (as read from the config file)
+//****************************************************************************
+typedef struct {
+	// VME links
+	QTPD_LinkConfig Link[QTPD_MAX_LINKS];
+	int NumLinks;
+	int NumConnections;				// CONNECTION lines found in the config file
+	// QTP boards (same settings for all the links)
+	uint16_t Iped;					// pedestal of the QDC (or resolution of the TDC)
+	uint16_t LLD[QTP_MAX_CH];		// low level thresholds
+	int EnableSuppression;			// zero and overflow suppression
+	// Software suppression (decoder)
+	int SwSuppression;
+	uint16_t SwThreshold[QTP_MAX_CH];	// lowest value kept (ADC counts)
+	int SwKeepOverflow;
+	int SwSuppressHistos;			// fill the histograms with the suppressed events
+	// Discriminator
+	uint16_t DiscrChMask;
+	uint16_t DiscrOutputWidth;
+	uint16_t DiscrThreshold[16];
+	int DiscrScanMode;				// 0 = no scan
+	int DiscrScanStart;				// threshold range of the scan
+	int DiscrScanStop;
+	int DiscrScanStep;
+	int DiscrScanTime;				// ms of each step
+	// LLD tuning from a pedestal run
+	int LldTuneMode;
+	float LldTuneSigmas;			// LLD = pedestal + LldTuneSigmas * sigma
+	int LldTuneTime;				// ms of the pedestal run
+	// Output files (written by the front-end)
+	char DataPath[128];
+	int EnableHistoFiles;
+	int EnableListFile;
+	int EnableRawDataFile;
+	int EnableStatsFile;
+	int EnableTimeStamps;
+	// Readout buffers and block transfers
+	int BltBufferCount;
+	int BltBufferSize;				// bytes
+	int BltHugePages;
+	int BltLockMemory;
+	int BltAdaptive;
+	int BltMinSize;
+	int BltSweepMode;
+	int BltSweepStepTime;			// ms
+	// Time stamps and rates
+	int TimerSource;
+	int RateWindow;					// ms
+	// Statistics
+	int PedWindow;
+	int PedTrackDepth;
+	int PeakHalfWidth;
+	// Calibration
+	int EnableCalib;
+	char CalibFileName[255];
+	int CalHistoBins;
+	float CalHistoMin;
+	float CalHistoMax;
+	// Histograms
+	int FillThreads;
+	int HistoBins;					// bins of the 1D histograms (power of 2, <= 4096)
+	int Hist2DMaxTiles;
+	int Hist2DPairs[HIST2D_MAX_PAIRS][3];	// chx, chy, bins
+	int NumHist2D;
+	int HistoArchiveInterval;		// s (0 = no archive)
+	// Event selection
+	FilterCfg Select;
+	// Streaming server
+	char StreamSocket[255];			// Unix domain socket ("" = TCP on the loopback interface)
+	int StreamTcpPort;				// 0 = disabled (unless StreamSocket is set)
+	int StreamRingSize;				// bytes
+	int StreamContent;				// STREAM_RAW | STREAM_EVENTS
+} QTPD_Config;
+
+//****************************************************************************
+// Read-only view of a readout block and of the events decoded from it
+//****************************************************************************
+typedef struct {
+	const uint32_t *raw;			// block as read from the board
+	int nwords;
+	uint64_t TimeStamp;				// read completion (ns from the start of the run)
+	int NevInBlock;					// event headers in the block
+	const QTP_Event *ev;			// decoded events (an event split across two blocks belongs to the second)
+	int nev;
+	const int *sel;					// indexes (in ev) of the events that pass the selection
+	int nsel;
+	int Board;						// index of the board (link) that produced the block
+	BufPool_Block *blk;				// readout buffer held by the view
+} QTPD_View;
+
+//****************************************************************************
+// Register image: values last written to the settings registers of a board
+//****************************************************************************
+typedef struct {
+	uint16_t Iped;
+	uint16_t LLD[QTP_MAX_CH];		// register values (threshold / 16)
+	uint16_t BitSet2;				// suppression bits set in the Bit Set 2 register
+	uint16_t DiscrChMask;
+	uint16_t DiscrOutputWidth;
+	uint16_t DiscrThreshold[16];
+} QTPD_RegImage;
+
+struct QTPD;
+typedef void (*QTPD_Callback)(const QTPD_View *view, void *user);
+
+//****************************************************************************
+// QTP board on a VME link: readout (link thread) and histograms (processing
+// thread). The outputs of the boards after the first one are prefixed by
+// "B<index>_".
+//****************************************************************************
+typedef struct QTPD_Board {
+	int Index;
+	QTPD_LinkConfig Link;
+	char Prefix[160];				// output path and prefix of the file names
+	// VME access
+	int32_t handle;
+	uint32_t BaseAddress;			// board being accessed by QTPD_ReadReg/QTPD_WriteReg
+	int VMEerror;
+	char ErrorString[100];
+	FILE *logfile;
+	// QTP board
+	uint16_t Model;
+	uint16_t Version;
+	char ModelVersion[3];
+	uint16_t FwRev;
+	uint16_t SerNum;
+	int NumCh;
+	QTPD_RegImage Image;
+	// readout
+	BufPool Pool;
+	BltSizer Sizer;
+	Decoder Dec;
+	QTPD_View *Views;				// one view for each block of the pool
+	int MaxEvents;					// events of each view
+	QTP_Event *EvBuf;				// decoded events of the views (MaxEvents for each block)
+	QTP_Event *SuppBuf;				// suppressed events of the views, when the fill threads read the decoded ones
+	uint64_t PrevBlockTime;
+	pthread_t Thread;				// readout thread of the link
+	struct QTPD *q;
+	// histograms and statistics
+	HistoSet histo;					// histograms (charge, peak or TAC)
+	int ns[QTP_MAX_CH];				// counts of each channel
+	HistoSet GatedHisto;			// histograms of the selected events (NumCh = 0 without selection)
+	Calib Cal;
+	volatile unsigned CalIn, CalOut;	// blocks entered / completed by the fill path of Cal (grace period of reloads)
+	Hist2DSet H2;
+	HistFill HFill;
+	Stats ChStats;
+	FILE *StatsFile;				// statistics file (V792nQDC_Stats.txt)
+	Filter Flt;
+	Suppressor Supp;
+	HistArchive Arch;				// time slices of histo (V792nQDC_HistoArchive.dat/.idx)
+	pthread_mutex_t Lock;			// held while histograms and statistics are filled, merged, saved or cleared
+} QTPD_Board;
+
+//****************************************************************************
+// Library handle
+//****************************************************************************
+typedef struct QTPD {
+	QTPD_Config cfg;
+	QTPD_Board *Board[QTPD_MAX_LINKS];
+	int NumBoards;
+	int Threaded;					// one readout thread per link (always, unless a single link has a single buffer)
+	uint64_t RunStart;				// ns (common time base of all the links, set by QTPD_Start)
+	uint64_t ArchiveStart;			// ns (set by QTPD_Open): time base of the histogram archives, which span all the runs
+	RateMeter Rates;				// total rates
+	// blocks decoded by the link threads, waiting to be processed
+	const QTPD_View **Queue;
+	int QueueSize, QueueHead, QueueCount;
+	pthread_mutex_t QueueLock;
+	pthread_cond_t QueueCond;
+	volatile int LinksRunning;
+	// run control
+	QTPD_Callback Callback;
+	void *User;
+	pthread_t Thread;
+	volatile int Running;			// the callback thread is running
+	volatile int ResetReq;
+	int Segment;					// run segment (incremented by QTPD_Reconfigure)
+} QTPD;
+
+//****************************************************************************
+// Function prototypes
+// With a callback, the views are processed in the readout thread. While it
+// runs, another thread can call QTPD_Reset, QTPD_Refresh, QTPD_ReloadCalib,
+// QTPD_SaveHistograms, QTPD_PrintStats and QTPD_RunTime: they take the Lock
+// of each board, held by the readout thread while it processes a block.
+// The histograms and statistics of a board (histo, ns, GatedHisto, Cal, H2,
+// ChStats, Flt, Supp) can be read directly only in the callback or between
+// QTPD_LockBoard and QTPD_UnlockBoard. QTPD_Read, QTPD_Reconfigure, the scans
+// and the LLD tuning can't be called until QTPD_Stop.
+//****************************************************************************
+void QTPD_ConfigDefault(QTPD_Config *cfg);
+void QTPD_ConfigParse(QTPD_Config *cfg, const char *key, FILE *f_ini);
+int QTPD_ConfigLoad(QTPD_Config *cfg, const char *FileName);
+
+int QTPD_Open(QTPD *q, const QTPD_Config *cfg);
+int QTPD_Configure(QTPD *q);
+int QTPD_Reconfigure(QTPD *q, const QTPD_Config *cfg);
+int QTPD_Start(QTPD *q);
+void QTPD_Stop(QTPD *q);
+void QTPD_Close(QTPD *q);
+
+void QTPD_SetCallback(QTPD *q, QTPD_Callback cb, void *user);
+const QTPD_View *QTPD_Read(QTPD *q);
+void QTPD_Retain(const QTPD_View *view);
+void QTPD_Release(const QTPD_View *view);
+
+uint64_t QTPD_RunTime(QTPD *q);
+void QTPD_Reset(QTPD *q);
+void QTPD_Refresh(QTPD *q);
+int QTPD_ReloadCalib(QTPD *q);
+int QTPD_SaveHistograms(QTPD *q);
+void QTPD_PrintStats(QTPD *q, FILE *f);
+QTPD_Board *QTPD_FindChannel(QTPD *q, int GlobalCh, int *ch);
+void QTPD_LockBoard(QTPD_Board *b);
+void QTPD_UnlockBoard(QTPD_Board *b);
+int QTPD_BltSweep(QTPD *q, FILE *fout, int (*StopReq)(void));
+int QTPD_DiscrScan(QTPD *q, FILE *fout, int (*StopReq)(void));
+int QTPD_TuneLLD(QTPD *q);
+
+uint16_t QTPD_ReadReg(QTPD_Board *b, uint16_t reg_addr);
+void QTPD_WriteReg(QTPD_Board *b, uint16_t reg_addr, uint16_t data);
+int QTPD_ReadRegs(QTPD_Board *b, const uint16_t *reg_addr, uint16_t *data, int n);
+int QTPD_WriteRegs(QTPD_Board *b, const uint16_t *reg_addr, const uint16_t *data, int n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
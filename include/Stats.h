@@ -0,0 +1,71 @@
+/******************************************************************************
+*
+* CAEN SpA - Front End Division
+* Via Vetraia, 11 - 55049 - Viareggio ITALY
+* +390594388398 - www.caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This program is free software; you can redistribute it and/or modify it under
+* the terms of the GNU General Public License as published by the Free Software
+* Foundation. This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "Histo.h"
+
+#define STATS_MAX_CH			32
+#define STATS_NO_DATA			0xFFFF	// value of the channels not present in the event
+#define STATS_PED_MIN_COUNTS	100		// counts needed to seed the pedestal tracker
+
+//****************************************************************************
+// Running sums, one lane per channel (laid out for vectorized accumulation)
+//****************************************************************************
+typedef struct {
+	uint64_t Count[STATS_MAX_CH] __attribute__((aligned(64)));
+	uint64_t Sum[STATS_MAX_CH] __attribute__((aligned(64)));
+	uint64_t SumSq[STATS_MAX_CH] __attribute__((aligned(64)));
+} StatSums;
+
+//****************************************************************************
+// Online statistics of the channels
+//****************************************************************************
+typedef struct {
+	int NumCh;
+	double Lsb2Phy;					// ADC count to physical unit
+	StatSums Run;					// since the start of the run (or the last reset)
+	StatSums Period;				// since the last publication
+	// pedestal tracking
+	int PedWindow;					// half width of the acceptance window around the pedestal (ADC counts)
+	int PedDepth;					// number of events of the moving average
+	int PedValid[STATS_MAX_CH];
+	float Ped[STATS_MAX_CH];		// pedestal position
+	float PedVar[STATS_MAX_CH];		// pedestal variance
+	// peak search (above the pedestal window)
+	int PeakHalfWidth;				// half width of the centroid window (ADC counts)
+	int PeakMin[STATS_MAX_CH];		// lowest bin of the peak search
+	int PeakBin[STATS_MAX_CH];		// highest bin found so far
+	uint32_t PeakMax[STATS_MAX_CH];	// counts in PeakBin
+	FILE *out;						// statistics file
+} Stats;
+
+//****************************************************************************
+// Function prototypes
+//****************************************************************************
+void Stats_Init(Stats *st, int NumCh, double Lsb2Phy, int PedWindow, int PedDepth, int PeakHalfWidth, FILE *out);
+void Stats_Reset(Stats *st);
+void Stats_AddEvent(Stats *st, const uint16_t *data, const HistoSet *histo);
+void Stats_FindPeaks(Stats *st, const HistoSet *histo);
+void Stats_Publish(Stats *st, const HistoSet *histo, uint64_t time, int EndOfRun);
+void Stats_Print(Stats *st, const HistoSet *histo, int ch);
+uint64_t Stats_FitPedestal(const HistoSet *histo, int ch, int Window, double *ped, double *sigma);
+
+#endif
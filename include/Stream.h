@@ -0,0 +1,101 @@
+/******************************************************************************
+*
+* CAEN SpA - Front End Division
+* Via Vetraia, 11 - 55049 - Viareggio ITALY
+* +390594388398 - www.caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This program is free software; you can redistribute it and/or modify it under
+* the terms of the GNU General Public License as published by the Free Software
+* Foundation. This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#ifndef _STREAM_H
+#define _STREAM_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "Decoder.h"
+
+#define STREAM_MAX_CLIENTS		16
+#define STREAM_MAX_SEND			(256*1024)	// max bytes of a single write to a client
+
+// Content of the stream
+#define STREAM_RAW				1		// readout blocks as read from the board
+#define STREAM_EVENTS			2		// decoded events (the selected ones)
+
+//****************************************************************************
+// Stream format: a sequence of records, each one made of a header and a
+// payload padded to 8 bytes.
+// STREAM_REC_RAW payload: the 32 bit words of a readout block.
+// STREAM_REC_EVENTS payload: a sequence of events, each one made of a
+// StreamEvent followed by one uint16_t value for each bit set in ChMask
+// (increasing channel order), padded to 8 bytes.
+//****************************************************************************
+#define STREAM_REC_RAW			1
+#define STREAM_REC_EVENTS		2
+
+typedef struct {
+	uint16_t Type;
+	uint16_t Board;					// index of the board (VME link) that produced the data
+	uint32_t Size;					// payload bytes (without padding)
+	uint64_t TimeStamp;				// ns from the start of the run (block read completion)
+} StreamRecHeader;
+
+typedef struct {
+	uint32_t EventNum;
+	uint32_t ChMask;
+	uint64_t TimeStamp;
+} StreamEvent;
+
+//****************************************************************************
+// Subscriber: private cursor over the shared ring
+//****************************************************************************
+typedef struct {
+	int fd;							// -1 = free slot
+	uint64_t Cursor;				// next byte to send (absolute ring position)
+	uint64_t RecEnd;				// end of the record being sent
+	uint64_t Sent;					// bytes
+	uint64_t Dropped;				// bytes skipped because the client was too slow
+} StreamClient;
+
+//****************************************************************************
+// Stream server: one ring written by the acquisition thread, sent to the
+// subscribers by the server thread
+//****************************************************************************
+typedef struct {
+	int Content;					// STREAM_RAW | STREAM_EVENTS
+	uint8_t *Ring;
+	uint64_t Size;					// power of 2
+	volatile uint64_t Head;			// end of the published records
+	volatile uint64_t Reserve;		// end of the record being written (the ring before Reserve - Size is overwritten)
+	uint8_t *Scratch;				// encoding of the event records
+	int ScratchSize;
+	int ListenFd;
+	int WakeFd[2];					// pipe used to wake up the server thread
+	volatile int Idle;				// server thread waiting in poll
+	char SocketPath[255];
+	StreamClient Client[STREAM_MAX_CLIENTS];
+	int NumClients;
+	uint64_t RecDropped;			// records too large for the ring
+	uint64_t Disconnected;			// clients closed because they lost part of a record (overrun by the writer)
+	pthread_t Thread;
+	volatile int Quit;
+} StreamServer;
+
+//****************************************************************************
+// Function prototypes
+//****************************************************************************
+int Stream_Open(StreamServer *srv, const char *SocketPath, int TcpPort, int RingSize, int Content);
+void Stream_PutBlock(StreamServer *srv, int Board, const uint32_t *raw, int nwords, uint64_t TimeStamp);
+void Stream_PutEvents(StreamServer *srv, int Board, const QTP_Event *ev, const int *sel, int nsel, uint64_t TimeStamp);
+void Stream_PrintStats(StreamServer *srv, FILE *f);
+void Stream_Close(StreamServer *srv);
+
+#endif
@@ -0,0 +1,52 @@
+/******************************************************************************
+*
+* CAEN SpA - Front End Division
+* Via Vetraia, 11 - 55049 - Viareggio ITALY
+* +390594388398 - www.caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This program is free software; you can redistribute it and/or modify it under
+* the terms of the GNU General Public License as published by the Free Software
+* Foundation. This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#ifndef _TIMER_H
+#define _TIMER_H
+
+#include <stdint.h>
+
+#define TIMER_SOURCE_MONOTONIC	0	// clock_gettime(CLOCK_MONOTONIC_RAW)
+#define TIMER_SOURCE_TSC		1	// CPU time stamp counter, calibrated against the monotonic clock
+
+#define RATE_MAX_BUCKETS		64
+
+//****************************************************************************
+// Sliding window rate meter: events and bytes are accumulated in time
+// buckets; the rate is computed over the last NumBuckets buckets.
+//****************************************************************************
+typedef struct {
+	uint64_t BucketWidth;			// ns
+	int NumBuckets;
+	uint64_t Start[RATE_MAX_BUCKETS];	// start time of each bucket (ns)
+	uint64_t Events[RATE_MAX_BUCKETS];
+	uint64_t Bytes[RATE_MAX_BUCKETS];
+	int Last;						// bucket being filled
+} RateMeter;
+
+//****************************************************************************
+// Function prototypes
+//****************************************************************************
+int Timer_Init(int Source);
+int Timer_Source();
+uint64_t Timer_Now();
+double Timer_TicksPerNs();
+
+void RateMeter_Init(RateMeter *rm, int WindowMs, uint64_t now);
+void RateMeter_Add(RateMeter *rm, uint64_t now, uint64_t nev, uint64_t nbytes);
+void RateMeter_Get(RateMeter *rm, uint64_t now, double *EventRate, double *ByteRate);
+
+#endif
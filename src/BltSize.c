@@ -0,0 +1,158 @@
+/******************************************************************************
+*
+* CAEN SpA - Front End Division
+* Via Vetraia, 11 - 55049 - Viareggio ITALY
+* +390594388398 - www.caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This program is free software; you can redistribute it and/or modify it under
+* the terms of the GNU General Public License as published by the Free Software
+* Foundation. This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#include <string.h>
+
+#include <CAENVMElib.h>
+#include <CAENVMEtypes.h>
+
+#include "BltSize.h"
+#include "Decoder.h"
+#include "Timer.h"
+
+#define AVG_WEIGHT			0.125	// weight of the last transfer in the moving average
+
+
+static int AlignSize(int size)
+{
+	return (size + BLT_SIZE_ALIGN - 1) & ~(BLT_SIZE_ALIGN - 1);
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: initialize the size controller. In fixed mode every transfer asks for MaxSize.
+// ---------------------------------------------------------------------------------------------------------
+void BltSizer_Init(BltSizer *bs, int MinSize, int MaxSize, int Adaptive)
+{
+	memset(bs, 0, sizeof(BltSizer));
+	bs->MaxSize = MaxSize & ~(BLT_SIZE_ALIGN - 1);
+	bs->MinSize = AlignSize(MinSize > 0 ? MinSize : BLT_MIN_SIZE_DEFAULT);
+	if (bs->MinSize > bs->MaxSize)
+		bs->MinSize = bs->MaxSize;
+	bs->Adaptive = Adaptive;
+	bs->CurSize = Adaptive ? bs->MinSize : bs->MaxSize;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: tell if the board status is worth reading after a transfer. This is the case only
+//              when the transfer was cut by the request size, i.e. the board may have more data.
+// Return:		1 = read the status register, 0 = not needed
+// ---------------------------------------------------------------------------------------------------------
+int BltSizer_NeedsStatus(BltSizer *bs, int bcnt)
+{
+	return bs->Adaptive && (bcnt >= bs->CurSize) && (bs->CurSize < bs->MaxSize);
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: choose the size of the next transfer from the history of the returned bytes.
+//              A truncated transfer doubles the size (or jumps to the max if the board buffer is
+//              full); the size shrinks slowly towards twice the average block.
+// ---------------------------------------------------------------------------------------------------------
+void BltSizer_Update(BltSizer *bs, int bcnt, int BoardFull)
+{
+	int target;
+
+	bs->NumTransfers++;
+	if (bcnt <= 0)
+		return;
+	bs->AvgBytes += AVG_WEIGHT * (bcnt - bs->AvgBytes);
+	if (!bs->Adaptive)
+		return;
+
+	if (bcnt >= bs->CurSize) {
+		bs->NumTruncated++;
+		if (BoardFull)
+			bs->CurSize = bs->MaxSize;
+		else
+			bs->CurSize = bs->CurSize * 2 < bs->MaxSize ? bs->CurSize * 2 : bs->MaxSize;
+		return;
+	}
+
+	target = AlignSize((int)(2 * bs->AvgBytes));
+	if (target < bs->MinSize)
+		target = bs->MinSize;
+	if (target < bs->CurSize / 2)
+		bs->CurSize /= 2;
+	else if (target < bs->CurSize)
+		bs->CurSize = target;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: count the event headers in a block of data
+// ---------------------------------------------------------------------------------------------------------
+int CountEvents(uint32_t *buffer, int nw)
+{
+	int i, nev = 0;
+	for(i=0; i<nw; i++)
+		nev += ((buffer[i] & DATATYPE_MASK) == DATATYPE_HEADER);
+	return nev;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: measure the readout throughput for every request size from MinSize to the size of
+//              the readout buffers (doubling at each step). Each step lasts StepTime ms; the board
+//              must be running (triggers enabled) during the sweep. StopReq (may be NULL) is
+//              called after each step: the sweep ends when it returns non zero.
+// Return:		0=OK, -1=error
+// ---------------------------------------------------------------------------------------------------------
+int BltSweep(int32_t handle, uint32_t BaseAddress, BufPool *pool, int MinSize, int StepTime, FILE *fout, int (*StopReq)(void))
+{
+	BufPool_Block *blk;
+	int size, bcnt;
+
+	blk = BufPool_Get(pool);
+	if (blk == NULL)
+		return -1;
+
+	printf("\nBlock transfer size sweep (%d ms per step)\n", StepTime);
+	printf("%10s %10s %12s %12s %12s %12s\n", "Size[B]", "MB/s", "Events/s", "Transf/s", "AvgBytes", "Full[%]");
+	if (fout != NULL)
+		fprintf(fout, "# size_bytes MB_per_s events_per_s transfers_per_s avg_bytes truncated_percent\n");
+
+	for(size = AlignSize(MinSize > 0 ? MinSize : BLT_MIN_SIZE_DEFAULT); size <= blk->size; size *= 2) {
+		uint64_t nb = 0, nev = 0, ntr = 0, nfull = 0;
+		uint64_t t0, t;
+		double sec;
+
+		t0 = Timer_Now();
+		do {
+			bcnt = 0;
+			CAENVME_FIFOMBLTReadCycle(handle, BaseAddress, (char *)blk->data, size, cvA32_U_MBLT, &bcnt);
+			ntr++;
+			if (bcnt > 0) {
+				nb += bcnt;
+				nev += CountEvents(blk->data, bcnt/4);
+				nfull += (bcnt >= size);
+			}
+			t = Timer_Now();
+		} while ((t - t0) < (uint64_t)StepTime * 1000000);
+
+		sec = (double)(t - t0) / 1e9;
+		printf("%10d %10.3f %12.1f %12.1f %12.1f %12.1f\n", size, nb / (1024.0 * 1024.0) / sec,
+			nev / sec, ntr / sec, ntr > 0 ? (double)nb / ntr : 0.0, ntr > 0 ? 100.0 * nfull / ntr : 0.0);
+		if (fout != NULL)
+			fprintf(fout, "%d %.4f %.1f %.1f %.1f %.1f\n", size, nb / (1024.0 * 1024.0) / sec,
+				nev / sec, ntr / sec, ntr > 0 ? (double)nb / ntr : 0.0, ntr > 0 ? 100.0 * nfull / ntr : 0.0);
+		if ((StopReq != NULL) && StopReq())
+			break;
+	}
+	BufPool_Release(blk);
+	return 0;
+}
@@ -0,0 +1,209 @@
+/******************************************************************************
+*
+* CAEN SpA - Front End Division
+* Via Vetraia, 11 - 55049 - Viareggio ITALY
+* +390594388398 - www.caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This program is free software; you can redistribute it and/or modify it under
+* the terms of the GNU General Public License as published by the Free Software
+* Foundation. This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "BufferPool.h"
+
+#define HUGE_PAGE_SIZE		(2*1024*1024)
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: allocate the memory of the pool (huge pages if requested and available, otherwise
+//              normal pages). All the blocks are carved out of a single area.
+// Return:		0=OK, -1=error
+// ---------------------------------------------------------------------------------------------------------
+static int AllocPoolMemory(BufPool *pool, int UseHugePages)
+{
+	void *mem;
+
+	pool->HugePages = 0;
+#ifdef MAP_HUGETLB
+	if (UseHugePages) {
+		size_t hsize = (pool->MemSize + HUGE_PAGE_SIZE - 1) & ~((size_t)HUGE_PAGE_SIZE - 1);
+		mem = mmap(NULL, hsize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (mem != MAP_FAILED) {
+			pool->mem = mem;
+			pool->MemSize = hsize;
+			pool->HugePages = 1;
+			return 0;
+		}
+		printf("Huge pages not available for the readout buffers; using normal pages\n");
+	}
+#endif
+	mem = mmap(NULL, pool->MemSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED)
+		return -1;
+	pool->mem = mem;
+	return 0;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: create a pool of NumBlocks readout buffers of BlockSize bytes each.
+//              The memory is touched (and optionally locked) here, so that no page fault
+//              and no malloc happens in the acquisition loop.
+// Return:		0=OK, -1=error
+// ---------------------------------------------------------------------------------------------------------
+int BufPool_Init(BufPool *pool, int NumBlocks, int BlockSize, int UseHugePages, int LockMemory)
+{
+	long PageSize = sysconf(_SC_PAGESIZE);
+	int i;
+
+	memset(pool, 0, sizeof(BufPool));
+	if (NumBlocks < 1)
+		NumBlocks = 1;
+	if (BlockSize < PageSize)
+		BlockSize = (int)PageSize;
+	BlockSize = (int)((BlockSize + PageSize - 1) & ~(PageSize - 1));
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pool->NumBlocks = NumBlocks;
+	pool->BlockSize = BlockSize;
+	pool->MemSize = (size_t)NumBlocks * BlockSize;
+	if (AllocPoolMemory(pool, UseHugePages) < 0) {
+		printf("Can't allocate %d readout buffers of %d bytes\n", NumBlocks, BlockSize);
+		BufPool_Close(pool);
+		return -1;
+	}
+	memset(pool->mem, 0, pool->MemSize);  // pre-fault all the pages
+
+	if (LockMemory) {
+		if (mlock(pool->mem, pool->MemSize) == 0)
+			pool->Locked = 1;
+		else
+			printf("Can't lock the readout buffers in memory (check 'ulimit -l')\n");
+	}
+
+	pool->blocks = (BufPool_Block *)calloc(NumBlocks, sizeof(BufPool_Block));
+	pool->FreeList = (int *)malloc(NumBlocks * sizeof(int));
+	if ((pool->blocks == NULL) || (pool->FreeList == NULL)) {
+		BufPool_Close(pool);
+		return -1;
+	}
+	for(i=0; i<NumBlocks; i++) {
+		pool->blocks[i].data = (uint32_t *)((char *)pool->mem + (size_t)i * BlockSize);
+		pool->blocks[i].size = BlockSize;
+		pool->blocks[i].index = i;
+		pool->blocks[i].pool = pool;
+		pool->FreeList[i] = NumBlocks - 1 - i;
+	}
+	pool->NumFree = NumBlocks;
+	pool->MinFree = NumBlocks;
+	return 0;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: lend a free block to the caller (with one reference)
+// Return:		pointer to the block or NULL if the pool is exhausted
+// ---------------------------------------------------------------------------------------------------------
+BufPool_Block *BufPool_Get(BufPool *pool)
+{
+	BufPool_Block *blk = NULL;
+
+	pthread_mutex_lock(&pool->lock);
+	if (pool->NumFree > 0) {
+		blk = &pool->blocks[pool->FreeList[--pool->NumFree]];
+		blk->refcnt = 1;
+		blk->nbytes = 0;
+		pool->hits++;
+		if (pool->NumFree < pool->MinFree)
+			pool->MinFree = pool->NumFree;
+	} else {
+		pool->misses++;
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return blk;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: add a reference to a block (for consumers that keep it after the readout has done)
+// ---------------------------------------------------------------------------------------------------------
+void BufPool_Retain(BufPool_Block *blk)
+{
+	__sync_fetch_and_add(&blk->refcnt, 1);
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: drop a reference; the block goes back to the free list with the last one
+// ---------------------------------------------------------------------------------------------------------
+void BufPool_Release(BufPool_Block *blk)
+{
+	BufPool *pool = blk->pool;
+
+	if (__sync_sub_and_fetch(&blk->refcnt, 1) > 0)
+		return;
+	pthread_mutex_lock(&pool->lock);
+	pool->FreeList[pool->NumFree++] = blk->index;
+	pool->returns++;
+	pthread_mutex_unlock(&pool->lock);
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: number of blocks currently available
+// ---------------------------------------------------------------------------------------------------------
+int BufPool_NumFree(BufPool *pool)
+{
+	int n;
+	pthread_mutex_lock(&pool->lock);
+	n = pool->NumFree;
+	pthread_mutex_unlock(&pool->lock);
+	return n;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: print occupancy and hit/miss statistics of the pool
+// ---------------------------------------------------------------------------------------------------------
+void BufPool_PrintStats(BufPool *pool, FILE *f)
+{
+	uint64_t req;
+
+	pthread_mutex_lock(&pool->lock);
+	req = pool->hits + pool->misses;
+	fprintf(f, "Buffer Pool: %d x %d KB (%s%s), free = %d (min %d), hits = %llu, misses = %llu (%.2f%%)\n",
+		pool->NumBlocks, pool->BlockSize / 1024,
+		pool->HugePages ? "huge pages" : "normal pages", pool->Locked ? ", locked" : "",
+		pool->NumFree, pool->MinFree,
+		(unsigned long long)pool->hits, (unsigned long long)pool->misses,
+		req > 0 ? 100.0 * pool->misses / req : 0.0);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: free the pool memory
+// ---------------------------------------------------------------------------------------------------------
+void BufPool_Close(BufPool *pool)
+{
+	if (pool->mem != NULL) {
+		if (pool->Locked)
+			munlock(pool->mem, pool->MemSize);
+		munmap(pool->mem, pool->MemSize);
+	}
+	if (pool->NumBlocks > 0)
+		pthread_mutex_destroy(&pool->lock);
+	if (pool->blocks != NULL) free(pool->blocks);
+	if (pool->FreeList != NULL) free(pool->FreeList);
+	memset(pool, 0, sizeof(BufPool));
+}
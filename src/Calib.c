@@ -0,0 +1,197 @@
+/******************************************************************************
+*
+* CAEN SpA - Front End Division
+* Via Vetraia, 11 - 55049 - Viareggio ITALY
+* +390594388398 - www.caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This program is free software; you can redistribute it and/or modify it under
+* the terms of the GNU General Public License as published by the Free Software
+* Foundation. This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/stat.h>
+
+#include "Calib.h"
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: fill the lookup tables of a calibration table from its coefficients
+// ---------------------------------------------------------------------------------------------------------
+static void BuildLUT(Calib *cal, CalTable *t)
+{
+	int ch, adc;
+	double BinWidth = (cal->Max - cal->Min) / cal->NumBins;
+
+	for(ch=0; ch<CALIB_MAX_CH; ch++) {
+		for(adc=0; adc<4096; adc++) {
+			double phy = (adc - t->Ped[ch]) * t->Gain[ch] + t->Offset[ch];
+			double bin = floor((phy - cal->Min) / BinWidth);
+			t->Bin[ch][adc] = ((bin < 0) || (bin >= cal->NumBins)) ? cal->NumBins : (uint16_t)bin;
+		}
+	}
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: allocate the tables and the calibrated histograms. The default table has no pedestal
+//              subtraction and the same gain (DefaultGain, e.g. LSB2PHY) for all the channels.
+// Return:		0=OK, -1=error
+// ---------------------------------------------------------------------------------------------------------
+int Calib_Init(Calib *cal, int NumCh, int NumBins, double Min, double Max, double DefaultGain)
+{
+	int ch;
+
+	memset(cal, 0, sizeof(Calib));
+	cal->NumCh = NumCh < CALIB_MAX_CH ? NumCh : CALIB_MAX_CH;
+	cal->NumBins = (NumBins > 0) && (NumBins < 65535) ? NumBins : 4096;
+	cal->Min = Min;
+	cal->Max = Max > Min ? Max : Min + cal->NumBins;
+	cal->Active = (CalTable *)malloc(sizeof(CalTable));
+	cal->CalHisto = (uint64_t *)calloc((size_t)cal->NumCh * (cal->NumBins + 1), sizeof(uint64_t));
+	if ((cal->Active == NULL) || (cal->CalHisto == NULL)) {
+		Calib_Close(cal);
+		return -1;
+	}
+	for(ch=0; ch<CALIB_MAX_CH; ch++) {
+		cal->Active->Ped[ch] = 0;
+		cal->Active->Gain[ch] = (float)DefaultGain;
+		cal->Active->Offset[ch] = 0;
+	}
+	BuildLUT(cal, cal->Active);
+	return 0;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: load the calibration file (lines "ch pedestal gain offset"; ch = -1 means all the
+//              channels; '#' starts a comment). The new table is built aside and then swapped with
+//              the active one, so it can be called while the run is going on. The replaced table is
+//              kept in Retired: the caller frees it with Calib_FreeRetired once the fill path can no
+//              longer be using it.
+// Return:		0=OK, -1=error (the active table is not changed)
+// ---------------------------------------------------------------------------------------------------------
+int Calib_Load(Calib *cal, const char *FileName)
+{
+	FILE *f;
+	CalTable *t;
+	char line[256];
+	struct stat fs;
+	int ch, i, n = 0;
+	float ped, gain, offset;
+
+	if ((f = fopen(FileName, "r")) == NULL) {
+		printf("Can't open calibration file %s\n", FileName);
+		return -1;
+	}
+	if ((t = (CalTable *)malloc(sizeof(CalTable))) == NULL) {
+		fclose(f);
+		return -1;
+	}
+	// start from the current coefficients (channels not in the file are left unchanged)
+	memcpy(t->Ped, cal->Active->Ped, sizeof(t->Ped));
+	memcpy(t->Gain, cal->Active->Gain, sizeof(t->Gain));
+	memcpy(t->Offset, cal->Active->Offset, sizeof(t->Offset));
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if ((line[0] == '#') || (sscanf(line, "%d %f %f %f", &ch, &ped, &gain, &offset) != 4))
+			continue;
+		for(i=0; i<CALIB_MAX_CH; i++) {
+			if ((ch < 0) || (ch == i)) {
+				t->Ped[i] = ped;
+				t->Gain[i] = gain;
+				t->Offset[i] = offset;
+			}
+		}
+		n++;
+	}
+	fclose(f);
+	if (n == 0) {
+		printf("No calibration coefficients found in %s\n", FileName);
+		free(t);
+		return -1;
+	}
+	BuildLUT(cal, t);
+
+	// a table left by a previous load without concurrent readers is not needed any more
+	Calib_FreeRetired(cal);
+	cal->Retired = __atomic_exchange_n(&cal->Active, t, __ATOMIC_SEQ_CST);
+	if (FileName != cal->FileName)
+		strncpy(cal->FileName, FileName, sizeof(cal->FileName) - 1);
+	if (stat(FileName, &fs) == 0)
+		cal->FileTime = fs.st_mtime;
+	cal->NumLoads++;
+	return 0;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: reload the calibration file if it has been modified since the last load
+// Return:		1 = reloaded, 0 = not changed, -1 = error
+// ---------------------------------------------------------------------------------------------------------
+int Calib_CheckReload(Calib *cal)
+{
+	struct stat fs;
+
+	if ((cal->FileName[0] == 0) || (stat(cal->FileName, &fs) != 0) || (fs.st_mtime == cal->FileTime))
+		return 0;
+	return Calib_Load(cal, cal->FileName) == 0 ? 1 : -1;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: free the table replaced by the last load. The readers of the fill path may still use
+//              it right after the swap: call it only when they have all moved past the swap.
+// ---------------------------------------------------------------------------------------------------------
+void Calib_FreeRetired(Calib *cal)
+{
+	if (cal->Retired != NULL) {
+		free(cal->Retired);
+		cal->Retired = NULL;
+	}
+}
+
+
+void Calib_Reset(Calib *cal)
+{
+	memset(cal->CalHisto, 0, (size_t)cal->NumCh * (cal->NumBins + 1) * sizeof(uint64_t));
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: save the calibrated histograms (one file per channel, "bin_center counts")
+// ---------------------------------------------------------------------------------------------------------
+int Calib_Save(Calib *cal, const char *DataPath)
+{
+	int ch, i;
+	double BinWidth = (cal->Max - cal->Min) / cal->NumBins;
+
+	for(ch=0; ch<cal->NumCh; ch++) {
+		FILE *fout;
+		char fname[300];
+		uint64_t *h = cal->CalHisto + (size_t)ch * (cal->NumBins + 1);
+		sprintf(fname, "%sV792nQDC_CalHisto_%d.txt", DataPath, ch);
+		if ((fout = fopen(fname, "w")) == NULL)
+			return -1;
+		for(i=0; i<cal->NumBins; i++)
+			fprintf(fout, "%g %llu\n", cal->Min + (i + 0.5) * BinWidth, (unsigned long long)h[i]);
+		fclose(fout);
+	}
+	return 0;
+}
+
+
+void Calib_Close(Calib *cal)
+{
+	if (cal->Active != NULL) free(cal->Active);
+	if (cal->Retired != NULL) free(cal->Retired);
+	if (cal->CalHisto != NULL) free(cal->CalHisto);
+	memset(cal, 0, sizeof(Calib));
+}
@@ -18,6 +18,7 @@
 
 #ifdef linux
     #include <sys/time.h> /* struct timeval, select() */
+    #include <time.h> /* clock_gettime() */
     #include <termios.h> /* tcgetattr(), tcsetattr() */
     #include <stdlib.h> /* atexit(), exit() */
     #include <unistd.h> /* read() */
@@ -57,16 +58,15 @@ static void raw(void)
 
 
 // --------------------------------------------------------------------------------------------------------- 
-// Description: get time from the computer
+// Description: get time from the computer (monotonic clock, not affected by the wall clock changes)
 // Return:		time in ms
 // --------------------------------------------------------------------------------------------------------- 
 long get_time()
 {
     long time_ms;
-    struct timeval t1;
-    struct timezone tz;
-    gettimeofday(&t1, &tz);
-    time_ms = (t1.tv_sec) * 1000 + t1.tv_usec / 1000;
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    time_ms = (t1.tv_sec) * 1000 + t1.tv_nsec / 1000000;
     return time_ms;
 }
 
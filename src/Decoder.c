@@ -0,0 +1,236 @@
+/******************************************************************************
+*
+* CAEN SpA - Front End Division
+* Via Vetraia, 11 - 55049 - Viareggio ITALY
+* +390594388398 - www.caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This program is free software; you can redistribute it and/or modify it under
+* the terms of the GNU General Public License as published by the Free Software
+* Foundation. This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#include <string.h>
+
+#include "Decoder.h"
+
+// bit of each channel in the masks (table lookup instead of a shift, so that the channel loops of the
+// software suppression are vectorized)
+static const uint32_t ChBit[QTP_MAX_CH] __attribute__((aligned(64))) = {
+	1u<<0,  1u<<1,  1u<<2,  1u<<3,  1u<<4,  1u<<5,  1u<<6,  1u<<7,
+	1u<<8,  1u<<9,  1u<<10, 1u<<11, 1u<<12, 1u<<13, 1u<<14, 1u<<15,
+	1u<<16, 1u<<17, 1u<<18, 1u<<19, 1u<<20, 1u<<21, 1u<<22, 1u<<23,
+	1u<<24, 1u<<25, 1u<<26, 1u<<27, 1u<<28, 1u<<29, 1u<<30, 1u<<31
+};
+
+
+void Decoder_Init(Decoder *dec, int NumCh)
+{
+	memset(dec, 0, sizeof(Decoder));
+	dec->NumCh = NumCh;
+	Decoder_Reset(dec);
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: drop the event being decoded and wait for a new header
+// ---------------------------------------------------------------------------------------------------------
+void Decoder_Reset(Decoder *dec)
+{
+	dec->DataType = DATATYPE_HEADER;
+	dec->Error = 0;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: set the time interval of the next block; the events of the block arrived between the
+//              previous read and this one, so their time stamps are interpolated over that interval
+// ---------------------------------------------------------------------------------------------------------
+void Decoder_SetBlockTime(Decoder *dec, uint64_t PrevBlockTime, uint64_t BlockTime, int NevInBlock)
+{
+	dec->BlockStart = PrevBlockTime;
+	dec->BlockDt = BlockTime - PrevBlockTime;
+	dec->NevInBlock = NevInBlock;
+	dec->EvInBlock = 0;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: decode a block of data read from the board. The decoding stops at the first filler
+//              or at the first word that does not match the expected type (dec->Error is set; the
+//              caller must clear the board buffer and call Decoder_Reset).
+// Return:		number of complete events written in ev[] (MaxEv >= nw/2 + 1 is always enough)
+// ---------------------------------------------------------------------------------------------------------
+int Decoder_DecodeBlock(Decoder *dec, const uint32_t *buffer, int nw, QTP_Event *ev, int MaxEv)
+{
+	int pnt, j, nev = 0;
+	QTP_Event *cur = &dec->Cur;
+
+	for(pnt=0; (pnt < nw) && (nev < MaxEv); pnt++) {
+		uint32_t d = buffer[pnt];
+
+		if ((d & DATATYPE_MASK) == DATATYPE_FILLER)
+			break;
+
+		switch (dec->DataType) {
+		/* header */
+		case DATATYPE_HEADER :
+			if ((d & DATATYPE_MASK) != DATATYPE_HEADER) {
+				dec->Error = 1;
+			} else {
+				dec->nch = (d >> 8) & 0x3F;
+				dec->chindex = 0;
+				dec->EvInBlock++;
+				cur->TimeStamp = dec->BlockStart + (dec->NevInBlock > 0 ? 
+					dec->BlockDt * dec->EvInBlock / dec->NevInBlock : dec->BlockDt);
+				cur->ChMask = 0;
+				cur->UnMask = 0;
+				cur->OvMask = 0;
+				cur->VMask = 0;
+				cur->Header = d;
+				memset(cur->Data, 0xFF, sizeof(cur->Data));
+				if (dec->nch > 0)
+					dec->DataType = DATATYPE_CHDATA;
+				else
+					dec->DataType = DATATYPE_EOB;
+			}
+			break;
+
+		/* Channel data */
+		case DATATYPE_CHDATA :
+			if ((d & DATATYPE_MASK) != DATATYPE_CHDATA) {
+				dec->Error = 1;
+			} else {
+				if (dec->NumCh == 32)
+					j = (int)((d >> 16) & 0x1F);  // for V792 (32 channels)
+				else
+					j = (int)((d >> 17) & 0x0F);  // for V792N (16 channels)
+				cur->Data[j] = d & 0xFFF;
+				cur->ChMask |= 1u << j;
+				cur->UnMask |= ((d & QTP_UN_BIT) != 0) << j;
+				cur->OvMask |= ((d & QTP_OV_BIT) != 0) << j;
+				cur->VMask |= ((d & QTP_V_BIT) != 0) << j;
+				if (dec->chindex == (dec->nch-1))
+					dec->DataType = DATATYPE_EOB;
+				dec->chindex++;
+			}
+			break;
+
+		/* EOB */
+		case DATATYPE_EOB :
+			if ((d & DATATYPE_MASK) != DATATYPE_EOB) {
+				dec->Error = 1;
+			} else {
+				dec->DataType = DATATYPE_HEADER;
+				cur->EventNum = d & 0xFFFFFF;
+				ev[nev++] = *cur;
+			}
+			break;
+		}
+		if (dec->Error)
+			break;
+	}
+	return nev;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: set the thresholds of the software suppression (Thr = QTP_MAX_CH values in ADC counts)
+// ---------------------------------------------------------------------------------------------------------
+void Suppressor_Init(Suppressor *sup, int Enabled, const uint16_t *Thr, int KeepOverflow)
+{
+	int i;
+
+	memset(sup, 0, sizeof(Suppressor));
+	sup->Enabled = Enabled;
+	sup->OvDrop = KeepOverflow ? 0 : 0xFFFFFFFF;
+	for(i=0; i<QTP_MAX_CH; i++)
+		sup->Thr[i] = Thr[i];
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: apply the software suppression to a batch of events, from in[] to out[] (out = in
+//              to work in place). The channels are compared all together with the same sequence of
+//              operations for every event; the events left empty are removed and the others are
+//              moved down.
+// Return:		number of events written in out[]
+// ---------------------------------------------------------------------------------------------------------
+int Decoder_Suppress(Suppressor *sup, const QTP_Event *in, QTP_Event *out, int nev)
+{
+	int e, i, n = 0;
+	uint64_t kept = 0, present = 0;
+
+	for(e=0; e<nev; e++) {
+		QTP_Event ev = in[e];
+		QTP_Event *x = &ev;
+		uint32_t keep = 0;
+
+		// a missing channel (QTP_NO_DATA) is removed by ChMask
+		for(i=0; i<QTP_MAX_CH; i++)
+			keep |= ChBit[i] & (0u - (uint32_t)(x->Data[i] >= sup->Thr[i]));
+		keep &= x->ChMask & ~x->UnMask & ~(x->OvMask & sup->OvDrop);
+		for(i=0; i<QTP_MAX_CH; i++)
+			x->Data[i] |= (uint16_t)(((ChBit[i] & keep) == 0) * QTP_NO_DATA);  // dropped channels
+		present += __builtin_popcount(x->ChMask);
+		kept += __builtin_popcount(keep);
+		x->ChMask = keep;
+		x->UnMask &= keep;
+		x->OvMask &= keep;
+		x->VMask &= keep;
+		out[n] = *x;
+		n += (keep != 0);
+	}
+	sup->ChKept += kept;
+	sup->ChDropped += present - kept;
+	sup->EvDropped += nev - n;
+	return n;
+}
+
+
+void Suppressor_Reset(Suppressor *sup)
+{
+	sup->ChKept = 0;
+	sup->ChDropped = 0;
+	sup->EvDropped = 0;
+}
+
+
+void Suppressor_PrintStats(Suppressor *sup, FILE *f)
+{
+	uint64_t tot = sup->ChKept + sup->ChDropped;
+	if (!sup->Enabled)
+		return;
+	fprintf(f, "SW suppression: channels kept = %llu, dropped = %llu (%.2f%% kept), empty events dropped = %llu\n",
+		(unsigned long long)sup->ChKept, (unsigned long long)sup->ChDropped, tot > 0 ? 100.0 * sup->ChKept / tot : 0.0,
+		(unsigned long long)sup->EvDropped);
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: write an event in the format of the list file: on a new line, "Board <Board> " (only if
+//              Board >= 0), the event number, the time stamp (if TimeStamps is set) and the values of
+//              the channels present
+// Return:		number of characters written
+// ---------------------------------------------------------------------------------------------------------
+int Decoder_PrintEvent(FILE *f, const QTP_Event *ev, int Board, int TimeStamps)
+{
+	int i, n;
+
+	if (Board >= 0)
+		n = fprintf(f, "\nBoard %d ", Board);
+	else
+		n = fprintf(f, "\n");
+	n += fprintf(f, "Event Num. %6d", ev->EventNum);
+	if (TimeStamps)
+		n += fprintf(f, " %14llu", (unsigned long long)ev->TimeStamp);
+	for(i=0; i<QTP_MAX_CH; i++) {
+		if (ev->Data[i] != QTP_NO_DATA)
+			n += fprintf(f, " %6d ", ev->Data[i]);
+	}
+	return n;
+}
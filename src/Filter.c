@@ -0,0 +1,173 @@
+/******************************************************************************
+*
+* CAEN SpA - Front End Division
+* Via Vetraia, 11 - 55049 - Viareggio ITALY
+* +390594388398 - www.caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This program is free software; you can redistribute it and/or modify it under
+* the terms of the GNU General Public License as published by the Free Software
+* Foundation. This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#include <string.h>
+
+#include "Filter.h"
+
+
+void FilterCfg_Init(FilterCfg *cfg)
+{
+	memset(cfg, 0, sizeof(FilterCfg));
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: parse one selection keyword of the config file
+//              SELECT_COINC_MASK mask(hex) [min]   coincidence (min channels of mask; default = all)
+//              SELECT_WINDOW ch low high           value window of a channel (ch = -1 means all)
+//              SELECT_MULTIPLICITY min max         number of channels in the event
+// Return:		1 if the keyword was a selection keyword, 0 otherwise
+// ---------------------------------------------------------------------------------------------------------
+int FilterCfg_Parse(FilterCfg *cfg, const char *key, FILE *f_ini)
+{
+	int i, ch, lo, hi;
+
+	if (strstr(key, "SELECT_COINC_MASK")!=NULL) {
+		char tail[100];
+		fscanf(f_ini, "%x", &cfg->CoincMask);
+		cfg->CoincMin = 0;
+		// optional number of channels: read the rest of the line
+		if (fgets(tail, sizeof(tail), f_ini) != NULL)
+			sscanf(tail, "%d", &cfg->CoincMin);
+		return 1;
+	}
+	if (strstr(key, "SELECT_WINDOW")!=NULL) {
+		fscanf(f_ini, "%d", &ch);
+		fscanf(f_ini, "%d", &lo);
+		fscanf(f_ini, "%d", &hi);
+		for(i=0; i<QTP_MAX_CH; i++) {
+			if ((ch < 0) || (ch == i)) {
+				cfg->WindowMask |= 1u << i;
+				cfg->WinLow[i] = (uint16_t)lo;
+				cfg->WinHigh[i] = (uint16_t)hi;
+			}
+		}
+		return 1;
+	}
+	if (strstr(key, "SELECT_MULTIPLICITY")!=NULL) {
+		fscanf(f_ini, "%d", &cfg->MultMin);
+		fscanf(f_ini, "%d", &cfg->MultMax);
+		cfg->MultSet = 1;
+		return 1;
+	}
+	return 0;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: turn the settings into the predicate. Cuts that are not set become "always true".
+// ---------------------------------------------------------------------------------------------------------
+void Filter_Compile(Filter *flt, const FilterCfg *cfg)
+{
+	int i;
+
+	memset(flt, 0, sizeof(Filter));
+	flt->Enabled = (cfg->CoincMask != 0) || (cfg->WindowMask != 0) || cfg->MultSet;
+	flt->CoincMask = cfg->CoincMask;
+	flt->CoincMin = (cfg->CoincMin > 0) ? cfg->CoincMin : __builtin_popcount(cfg->CoincMask);
+	flt->WindowMask = cfg->WindowMask;
+	for(i=0; i<QTP_MAX_CH; i++) {
+		if (cfg->WindowMask & (1u << i)) {
+			flt->WinLow[i] = cfg->WinLow[i];
+			flt->WinSpan[i] = cfg->WinHigh[i] >= cfg->WinLow[i] ? cfg->WinHigh[i] - cfg->WinLow[i] : 0;
+		} else {
+			flt->WinLow[i] = 0;
+			flt->WinSpan[i] = 0xFFFFFFFF;
+		}
+	}
+	if (cfg->MultSet) {
+		flt->MultMin = cfg->MultMin;
+		flt->MultSpan = cfg->MultMax >= cfg->MultMin ? cfg->MultMax - cfg->MultMin : 0;
+	} else {
+		flt->MultMin = 0;
+		flt->MultSpan = 0xFFFFFFFF;
+	}
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: evaluate the predicate on a batch of events. The indexes of the accepted events are
+//              written in sel[] (which must hold nev entries).
+// Return:		number of accepted events
+// ---------------------------------------------------------------------------------------------------------
+int Filter_Batch(Filter *flt, const QTP_Event *ev, int nev, int *sel)
+{
+	int e, i, n = 0;
+
+	if (!flt->Enabled) {
+		for(e=0; e<nev; e++)
+			sel[e] = e;
+		flt->Accepted += nev;
+		return nev;
+	}
+	for(e=0; e<nev; e++) {
+		const QTP_Event *x = &ev[e];
+		uint32_t inwin = 0, ok;
+		// a missing channel (QTP_NO_DATA) is outside any window
+		for(i=0; i<QTP_MAX_CH; i++)
+			inwin |= (uint32_t)((uint32_t)(x->Data[i] - flt->WinLow[i]) <= flt->WinSpan[i]) << i;
+		ok = ((inwin & flt->WindowMask) == flt->WindowMask);
+		ok &= ((uint32_t)__builtin_popcount(x->ChMask & flt->CoincMask) >= flt->CoincMin);
+		ok &= ((uint32_t)(__builtin_popcount(x->ChMask) - flt->MultMin) <= flt->MultSpan);
+		sel[n] = e;
+		n += ok;
+	}
+	flt->Accepted += n;
+	flt->Rejected += nev - n;
+	return n;
+}
+
+
+void Filter_Reset(Filter *flt)
+{
+	flt->Accepted = 0;
+	flt->Rejected = 0;
+}
+
+
+void Filter_PrintStats(Filter *flt, FILE *f)
+{
+	uint64_t tot = flt->Accepted + flt->Rejected;
+	if (!flt->Enabled)
+		return;
+	fprintf(f, "Selection: accepted = %llu, rejected = %llu (%.2f%% accepted)\n", (unsigned long long)flt->Accepted,
+		(unsigned long long)flt->Rejected, tot > 0 ? 100.0 * flt->Accepted / tot : 0.0);
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: write an event back in the board data format (header, channel data, EOB), for the
+//              raw data file of the selected events. The GEO address is taken from the header.
+// Return:		number of words written (max QTP_MAX_CH + 2)
+// ---------------------------------------------------------------------------------------------------------
+int EncodeEvent(const QTP_Event *ev, int NumCh, uint32_t *words)
+{
+	uint32_t geo = ev->Header & 0xF8000000;
+	uint32_t mask = ev->ChMask;
+	int n = 0, j;
+
+	words[n++] = (ev->Header & ~0x3F00) | (__builtin_popcount(mask) << 8);
+	while (mask) {
+		j = __builtin_ctz(mask);
+		mask &= mask - 1;
+		words[n++] = geo | DATATYPE_CHDATA | (j << (NumCh == 32 ? 16 : 17)) |
+			(((ev->UnMask >> j) & 1) ? QTP_UN_BIT : 0) | (((ev->OvMask >> j) & 1) ? QTP_OV_BIT : 0) |
+			(((ev->VMask >> j) & 1) ? QTP_V_BIT : 0) | ev->Data[j];
+	}
+	words[n++] = geo | DATATYPE_EOB | (ev->EventNum & 0xFFFFFF);
+	return n;
+}
@@ -0,0 +1,244 @@
+/******************************************************************************
+*
+* CAEN SpA - Front End Division
+* Via Vetraia, 11 - 55049 - Viareggio ITALY
+* +390594388398 - www.caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This program is free software; you can redistribute it and/or modify it under
+* the terms of the GNU General Public License as published by the Free Software
+* Foundation. This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Hist2D.h"
+
+
+static void FreePair(Hist2D *h)
+{
+	if (h->Tile != NULL) free(h->Tile);
+	if (h->TileHits != NULL) free(h->TileHits);
+	if (h->Arena != NULL) free(h->Arena);
+	if (h->SparseKey != NULL) free(h->SparseKey);
+	if (h->SparseVal != NULL) free(h->SparseVal);
+	if (h->Scratch != NULL) free(h->Scratch);
+	memset(h, 0, sizeof(Hist2D));
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: add a channel pair. Bins is rounded to a power of 2 between 32 and 4096; MaxTiles
+//              limits the memory of the dense tiles (MaxTiles x 4 KB; 0 = the whole plane).
+// Return:		0=OK, -1=error (the pairs already in the set are not changed)
+// ---------------------------------------------------------------------------------------------------------
+int Hist2D_Add(Hist2DSet *set, int ChX, int ChY, int Bins, int MaxTiles)
+{
+	Hist2D *h;
+	int ntiles;
+
+	if ((set->NumPairs >= HIST2D_MAX_PAIRS) || (ChX < 0) || (ChX >= QTP_MAX_CH) || (ChY < 0) || (ChY >= QTP_MAX_CH))
+		return -1;
+	h = &set->h[set->NumPairs];
+	memset(h, 0, sizeof(Hist2D));
+	h->ChX = ChX;
+	h->ChY = ChY;
+	h->Shift = 0;
+	h->Bins = 4096;
+	while ((h->Bins > Bins) && (h->Bins > HIST2D_TILE_SIZE)) {
+		h->Bins >>= 1;
+		h->Shift++;
+	}
+	h->TilesPerAxis = h->Bins / HIST2D_TILE_SIZE;
+	ntiles = h->TilesPerAxis * h->TilesPerAxis;
+	h->MaxTiles = ((MaxTiles <= 0) || (MaxTiles > ntiles)) ? ntiles : MaxTiles;
+
+	h->Tile = (uint32_t **)calloc(ntiles, sizeof(uint32_t *));
+	h->TileHits = (uint32_t *)calloc(ntiles, sizeof(uint32_t));
+	h->Arena = (uint32_t *)calloc((size_t)h->MaxTiles * HIST2D_TILE_BINS, sizeof(uint32_t));
+	h->SparseKey = (uint32_t *)calloc(HIST2D_SPARSE_SIZE, sizeof(uint32_t));
+	h->SparseVal = (uint32_t *)calloc(HIST2D_SPARSE_SIZE, sizeof(uint32_t));
+	h->Scratch = (uint32_t *)malloc(HIST2D_SPARSE_SIZE * 2 * sizeof(uint32_t));
+	if ((h->Tile == NULL) || (h->TileHits == NULL) || (h->Arena == NULL) || (h->SparseKey == NULL) || 
+		(h->SparseVal == NULL) || (h->Scratch == NULL)) {
+		FreePair(h);
+		return -1;
+	}
+	set->NumPairs++;
+	return 0;
+}
+
+
+static uint32_t *SparseSlot(Hist2D *h, uint32_t key, int insert)
+{
+	uint32_t i = (key * 2654435761u) & (HIST2D_SPARSE_SIZE - 1);
+	while (h->SparseKey[i] != 0) {
+		if (h->SparseKey[i] == key)
+			return &h->SparseVal[i];
+		i = (i + 1) & (HIST2D_SPARSE_SIZE - 1);
+	}
+	if (!insert || (h->SparseUsed >= HIST2D_SPARSE_SIZE / 2))  // keep the load factor low
+		return NULL;
+	h->SparseKey[i] = key;
+	h->SparseVal[i] = 0;
+	h->SparseUsed++;
+	return &h->SparseVal[i];
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: give a dense tile to a region and move its sparse counts into it; the sparse map is
+//              rebuilt without the moved entries (rare: at most MaxTiles times per run)
+// ---------------------------------------------------------------------------------------------------------
+static uint32_t *PromoteTile(Hist2D *h, int t)
+{
+	uint32_t *tile, *key, *val;
+	int i, n = 0;
+
+	if (h->NumTiles >= h->MaxTiles)
+		return NULL;
+	tile = h->Arena + (size_t)h->NumTiles * HIST2D_TILE_BINS;
+	h->NumTiles++;
+	h->Tile[t] = tile;
+
+	key = h->Scratch;
+	val = h->Scratch + HIST2D_SPARSE_SIZE;
+	for(i=0; i<HIST2D_SPARSE_SIZE; i++) {
+		if (h->SparseKey[i] != 0) {
+			key[n] = h->SparseKey[i];
+			val[n++] = h->SparseVal[i];
+		}
+	}
+	memset(h->SparseKey, 0, HIST2D_SPARSE_SIZE * sizeof(uint32_t));
+	h->SparseUsed = 0;
+	for(i=0; i<n; i++) {
+		uint32_t b = key[i] - 1;
+		int x = b % h->Bins, y = b / h->Bins;
+		int tt = (y >> HIST2D_TILE_BITS) * h->TilesPerAxis + (x >> HIST2D_TILE_BITS);
+		if (tt == t)
+			tile[((y & (HIST2D_TILE_SIZE - 1)) << HIST2D_TILE_BITS) + (x & (HIST2D_TILE_SIZE - 1))] += val[i];
+		else
+			*SparseSlot(h, key[i], 1) = val[i];
+	}
+	return tile;
+}
+
+
+static void Fill(Hist2D *h, int x, int y)
+{
+	int t = (y >> HIST2D_TILE_BITS) * h->TilesPerAxis + (x >> HIST2D_TILE_BITS);
+	uint32_t *tile = h->Tile[t];
+	uint32_t *slot;
+
+	h->Entries++;
+	if (tile != NULL) {
+		tile[((y & (HIST2D_TILE_SIZE - 1)) << HIST2D_TILE_BITS) + (x & (HIST2D_TILE_SIZE - 1))]++;
+		return;
+	}
+	if ((++h->TileHits[t] >= HIST2D_PROMOTE_HITS) && ((tile = PromoteTile(h, t)) != NULL)) {
+		tile[((y & (HIST2D_TILE_SIZE - 1)) << HIST2D_TILE_BITS) + (x & (HIST2D_TILE_SIZE - 1))]++;
+		return;
+	}
+	slot = SparseSlot(h, (uint32_t)(y * h->Bins + x) + 1, 1);
+	if ((slot == NULL) && ((tile = PromoteTile(h, t)) != NULL))  // sparse map full: force a tile
+		slot = &tile[((y & (HIST2D_TILE_SIZE - 1)) << HIST2D_TILE_BITS) + (x & (HIST2D_TILE_SIZE - 1))];
+	if (slot != NULL)
+		(*slot)++;
+	else
+		h->Lost++;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: fill all the pairs with a batch of events (pair by pair, so that each pass works on
+//              the tiles of one histogram only). Events without both channels are skipped.
+// ---------------------------------------------------------------------------------------------------------
+void Hist2D_FillEvents(Hist2DSet *set, const QTP_Event *ev, int nev)
+{
+	int p, i;
+
+	for(p=0; p<set->NumPairs; p++) {
+		Hist2D *h = &set->h[p];
+		uint32_t need = (1u << h->ChX) | (1u << h->ChY);
+		for(i=0; i<nev; i++) {
+			if ((ev[i].ChMask & need) != need)
+				continue;
+			Fill(h, ev[i].Data[h->ChX] >> h->Shift, ev[i].Data[h->ChY] >> h->Shift);
+		}
+	}
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: clear all the histograms (the tiles stay assigned to their regions)
+// ---------------------------------------------------------------------------------------------------------
+void Hist2D_Reset(Hist2DSet *set)
+{
+	int p;
+	for(p=0; p<set->NumPairs; p++) {
+		Hist2D *h = &set->h[p];
+		memset(h->Arena, 0, (size_t)h->NumTiles * HIST2D_TILE_BINS * sizeof(uint32_t));
+		memset(h->TileHits, 0, h->TilesPerAxis * h->TilesPerAxis * sizeof(uint32_t));
+		memset(h->SparseKey, 0, HIST2D_SPARSE_SIZE * sizeof(uint32_t));
+		h->SparseUsed = 0;
+		h->Entries = 0;
+		h->Lost = 0;
+	}
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: save the histograms as sparse lists "x y counts" (x, y = ADC value at the low edge of
+//              the bin), one file per pair: V792nQDC_Histo2D_<chx>_<chy>.txt
+// ---------------------------------------------------------------------------------------------------------
+int Hist2D_Save(Hist2DSet *set, const char *DataPath)
+{
+	int p, t, i;
+
+	for(p=0; p<set->NumPairs; p++) {
+		Hist2D *h = &set->h[p];
+		FILE *fout;
+		char fname[300];
+
+		sprintf(fname, "%sV792nQDC_Histo2D_%d_%d.txt", DataPath, h->ChX, h->ChY);
+		if ((fout = fopen(fname, "w")) == NULL)
+			return -1;
+		fprintf(fout, "# ch%d vs ch%d, %d x %d bins, entries = %llu, lost = %llu\n", h->ChX, h->ChY, h->Bins, h->Bins,
+			(unsigned long long)h->Entries, (unsigned long long)h->Lost);
+		// dense tiles
+		for(t=0; t<h->TilesPerAxis * h->TilesPerAxis; t++) {
+			int x0 = (t % h->TilesPerAxis) << HIST2D_TILE_BITS;
+			int y0 = (t / h->TilesPerAxis) << HIST2D_TILE_BITS;
+			if (h->Tile[t] == NULL)
+				continue;
+			for(i=0; i<HIST2D_TILE_BINS; i++) {
+				if (h->Tile[t][i] > 0)
+					fprintf(fout, "%d %d %u\n", (x0 + (i & (HIST2D_TILE_SIZE - 1))) << h->Shift,
+						(y0 + (i >> HIST2D_TILE_BITS)) << h->Shift, h->Tile[t][i]);
+			}
+		}
+		// sparse regions
+		for(i=0; i<HIST2D_SPARSE_SIZE; i++) {
+			uint32_t b = h->SparseKey[i] - 1;
+			if ((h->SparseKey[i] != 0) && (h->SparseVal[i] > 0))
+				fprintf(fout, "%d %d %u\n", (int)(b % h->Bins) << h->Shift, (int)(b / h->Bins) << h->Shift, h->SparseVal[i]);
+		}
+		fclose(fout);
+	}
+	return 0;
+}
+
+
+void Hist2D_Close(Hist2DSet *set)
+{
+	int p;
+	for(p=0; p<set->NumPairs; p++)
+		FreePair(&set->h[p]);
+	memset(set, 0, sizeof(Hist2DSet));
+}
@@ -0,0 +1,370 @@
+/******************************************************************************
+*
+* CAEN SpA - Front End Division
+* Via Vetraia, 11 - 55049 - Viareggio ITALY
+* +390594388398 - www.caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This program is free software; you can redistribute it and/or modify it under
+* the terms of the GNU General Public License as published by the Free Software
+* Foundation. This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "HistArchive.h"
+
+// largest encoding of a channel: bin count + (gap, counts) for each bin
+#define HARCH_CH_MAXBYTES		(5 + HARCH_BINS * (2 + 5))
+
+
+static uint8_t *PutVarint(uint8_t *p, uint32_t v)
+{
+	while (v >= 0x80) {
+		*p++ = (uint8_t)(v | 0x80);
+		v >>= 7;
+	}
+	*p++ = (uint8_t)v;
+	return p;
+}
+
+static const uint8_t *GetVarint(const uint8_t *p, const uint8_t *end, uint32_t *v)
+{
+	uint32_t x = 0;
+	int sh;
+
+	for(sh=0; (p < end) && (sh < 35); sh+=7) {
+		x |= (uint32_t)(*p & 0x7F) << sh;
+		if ((*p++ & 0x80) == 0) {
+			*v = x;
+			return p;
+		}
+	}
+	return NULL;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: create the archive files FileName.dat and FileName.idx (IntervalMs <= 0 = disabled).
+//              Now (Timer_Now) is the start of the archive: the times of the slices are ns from it,
+//              and WallStart of the header is the wall clock time at the same moment.
+// Return:		0=OK, -1=error
+// ---------------------------------------------------------------------------------------------------------
+int HistArchive_Open(HistArchive *ha, const char *FileName, int NumCh, int Bins, int IntervalMs, uint64_t Now)
+{
+	HArch_FileHeader hdr;
+	char fname[300];
+
+	memset(ha, 0, sizeof(HistArchive));
+	if (IntervalMs <= 0)
+		return 0;
+	ha->NumCh = NumCh > HARCH_MAX_CH ? HARCH_MAX_CH : NumCh;
+	ha->Bins = Bins > HARCH_BINS ? HARCH_BINS : Bins;
+	ha->Interval = (uint64_t)IntervalMs * 1000000;
+	ha->T0 = Now;
+	ha->Prev = (uint32_t *)calloc((size_t)ha->NumCh * ha->Bins, sizeof(uint32_t));
+	ha->Buf = (uint8_t *)malloc(HARCH_CH_MAXBYTES);
+	sprintf(fname, "%s.dat", FileName);
+	ha->fdat = fopen(fname, "wb");
+	sprintf(fname, "%s.idx", FileName);
+	ha->fidx = fopen(fname, "wb");
+	if ((ha->Prev == NULL) || (ha->Buf == NULL) || (ha->fdat == NULL) || (ha->fidx == NULL)) {
+		HistArchive_Close(ha);
+		return -1;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.Magic = HARCH_MAGIC;
+	hdr.Version = HARCH_VERSION;
+	hdr.NumCh = (uint16_t)ha->NumCh;
+	hdr.Bins = ha->Bins;
+	hdr.Interval = IntervalMs;
+	hdr.WallStart = (int64_t)time(NULL);
+	fwrite(&hdr, sizeof(hdr), 1, ha->fdat);
+	fwrite(&hdr, sizeof(hdr), 1, ha->fidx);
+	fflush(ha->fdat);
+	fflush(ha->fidx);
+	ha->DatSize = sizeof(hdr);
+	ha->Enabled = 1;
+	return 0;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: check if the current slice is complete
+// Return:		1=yes, 0=no (or archive disabled)
+// ---------------------------------------------------------------------------------------------------------
+int HistArchive_Due(HistArchive *ha, uint64_t Now)
+{
+	return ha->Enabled && (Now - ha->T0 >= ha->SliceStart + ha->Interval);
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: close the current slice: the difference between histo and the histograms at the end of
+//              the previous slice is appended to the archive. An empty slice shorter than the interval
+//              (forced by a stop or a reset) is not written. The differences are taken modulo 2^32, so
+//              they are exact also for the bins with 64 bit counters.
+// Return:		1=slice written, 0=nothing written, -1=write error
+// ---------------------------------------------------------------------------------------------------------
+int HistArchive_Update(HistArchive *ha, const HistoSet *histo, uint64_t Now, int Segment)
+{
+	HArch_Index ix;
+	uint64_t t = Now - ha->T0;
+	long pos;
+	int ch, i, ret = 1;
+
+	if (!ha->Enabled)
+		return 0;
+	memset(&ix, 0, sizeof(ix));
+	ix.Magic = HARCH_SLICE_MAGIC;
+	ix.Slice = ha->NumSlices;
+	ix.TStart = ha->SliceStart;
+	ix.TEnd = t;
+	ix.WallTime = (int64_t)time(NULL);
+	ix.Offset = ha->DatSize;
+	ix.Segment = Segment;
+	for(ch=0; ch<ha->NumCh; ch++) {
+		uint32_t *prev = &ha->Prev[ch * ha->Bins];
+		for(i=0; i<ha->Bins; i++)
+			ix.Counts += (uint32_t)Histo_GetBin(histo, ch, i) - prev[i];
+	}
+	if ((ix.Counts == 0) && (t < ha->SliceStart + ha->Interval)) {
+		ha->SliceStart = t;
+		return 0;
+	}
+
+	// the entry is written again at the end, when the size is known
+	pos = ftell(ha->fdat);
+	fwrite(&ix, sizeof(ix), 1, ha->fdat);
+	ix.Size = sizeof(ix);
+	for(ch=0; ch<ha->NumCh; ch++) {
+		uint32_t *prev = &ha->Prev[ch * ha->Bins];
+		uint8_t *p = ha->Buf + 5, *q;
+		uint32_t nb = 0;
+		int last = -1;
+		for(i=0; i<ha->Bins; i++) {
+			uint32_t c = (uint32_t)Histo_GetBin(histo, ch, i);
+			uint32_t d = c - prev[i];
+			if (d == 0)
+				continue;
+			prev[i] = c;
+			p = PutVarint(p, i - last);
+			p = PutVarint(p, d);
+			last = i;
+			nb++;
+		}
+		// bin count in front of the pairs (its length is known only now)
+		q = PutVarint(ha->Buf, nb);
+		memmove(q, ha->Buf + 5, p - (ha->Buf + 5));
+		p = q + (p - (ha->Buf + 5));
+		fwrite(ha->Buf, 1, p - ha->Buf, ha->fdat);
+		ix.Size += (uint32_t)(p - ha->Buf);
+	}
+	fseek(ha->fdat, pos, SEEK_SET);
+	fwrite(&ix, sizeof(ix), 1, ha->fdat);
+	fseek(ha->fdat, 0, SEEK_END);
+	if (ferror(ha->fdat) || (fwrite(&ix, sizeof(ix), 1, ha->fidx) != 1))
+		ret = -1;
+	// the index entry goes to disk after its slice
+	fflush(ha->fdat);
+	fflush(ha->fidx);
+
+	ha->DatSize += ix.Size;
+	ha->BytesWritten += ix.Size + sizeof(ix);
+	ha->NumSlices++;
+	ha->SliceStart = t;
+	return ret;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: the histograms have been cleared: the next slice starts from empty histograms
+// ---------------------------------------------------------------------------------------------------------
+void HistArchive_Reset(HistArchive *ha)
+{
+	if (ha->Enabled)
+		memset(ha->Prev, 0, (size_t)ha->NumCh * ha->Bins * sizeof(uint32_t));
+}
+
+
+void HistArchive_PrintStats(HistArchive *ha, FILE *f)
+{
+	if (ha->Enabled)
+		fprintf(f, "Histogram archive: %u slices of %.0f s, %.1f KB\n", ha->NumSlices, ha->Interval * 1e-9,
+			ha->BytesWritten / 1024.0);
+}
+
+
+void HistArchive_Close(HistArchive *ha)
+{
+	if (ha->fdat != NULL) fclose(ha->fdat);
+	if (ha->fidx != NULL) fclose(ha->fidx);
+	if (ha->Prev != NULL) free(ha->Prev);
+	if (ha->Buf != NULL) free(ha->Buf);
+	memset(ha, 0, sizeof(HistArchive));
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: open an archive for reading (FileName with or without the .dat/.idx extension)
+// Return:		0=OK, -1=error
+// ---------------------------------------------------------------------------------------------------------
+int HArchReader_Open(HArchReader *rd, const char *FileName)
+{
+	HArch_FileHeader h2;
+	char base[300], fname[310];
+	size_t n;
+	long size;
+
+	memset(rd, 0, sizeof(HArchReader));
+	strncpy(base, FileName, sizeof(base) - 1);
+	base[sizeof(base) - 1] = 0;
+	n = strlen(base);
+	if ((n > 4) && ((strcmp(base + n - 4, ".dat") == 0) || (strcmp(base + n - 4, ".idx") == 0)))
+		base[n - 4] = 0;
+	sprintf(fname, "%s.dat", base);
+	rd->fdat = fopen(fname, "rb");
+	sprintf(fname, "%s.idx", base);
+	rd->fidx = fopen(fname, "rb");
+	if ((rd->fdat == NULL) || (rd->fidx == NULL) ||
+		(fread(&rd->Hdr, sizeof(rd->Hdr), 1, rd->fdat) != 1) || (fread(&h2, sizeof(h2), 1, rd->fidx) != 1) ||
+		(rd->Hdr.Magic != HARCH_MAGIC) || (memcmp(&rd->Hdr, &h2, sizeof(h2)) != 0) ||
+		(rd->Hdr.NumCh > HARCH_MAX_CH) || (rd->Hdr.Bins == 0) || (rd->Hdr.Bins > HARCH_BINS)) {
+		HArchReader_Close(rd);
+		return -1;
+	}
+	fseek(rd->fidx, 0, SEEK_END);
+	size = ftell(rd->fidx);
+	rd->NumSlices = (uint32_t)((size - sizeof(HArch_FileHeader)) / sizeof(HArch_Index));  // an incomplete entry is ignored
+	rd->BufSize = sizeof(HArch_Index) + rd->Hdr.NumCh * HARCH_CH_MAXBYTES;
+	if ((rd->Buf = (uint8_t *)malloc(rd->BufSize)) == NULL) {
+		HArchReader_Close(rd);
+		return -1;
+	}
+	return 0;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: read the index entry of a slice
+// Return:		0=OK, -1=error
+// ---------------------------------------------------------------------------------------------------------
+int HArchReader_GetIndex(HArchReader *rd, uint32_t slice, HArch_Index *ix)
+{
+	if (slice >= rd->NumSlices)
+		return -1;
+	if ((fseek(rd->fidx, sizeof(HArch_FileHeader) + (long)slice * sizeof(HArch_Index), SEEK_SET) != 0) ||
+		(fread(ix, sizeof(HArch_Index), 1, rd->fidx) != 1) || (ix->Magic != HARCH_SLICE_MAGIC))
+		return -1;
+	return 0;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: first slice that ends after t (ns from the start of the archive)
+// Return:		slice number (NumSlices if there is none)
+// ---------------------------------------------------------------------------------------------------------
+uint32_t HArchReader_Find(HArchReader *rd, uint64_t t)
+{
+	uint32_t lo = 0, hi = rd->NumSlices;
+	HArch_Index ix;
+
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (HArchReader_GetIndex(rd, mid, &ix) < 0)
+			return rd->NumSlices;
+		if (ix.TEnd <= t)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: add the counts of a slice to histo
+// Return:		0=OK, -1=error (corrupted record)
+// ---------------------------------------------------------------------------------------------------------
+int HArchReader_Add(HArchReader *rd, uint32_t slice, uint32_t (*histo)[HARCH_BINS])
+{
+	HArch_Index ix, rec;
+	const uint8_t *p, *end;
+	uint32_t nb, gap, cnt;
+	int ch, bin;
+
+	if ((HArchReader_GetIndex(rd, slice, &ix) < 0) || (ix.Size > rd->BufSize) || (ix.Size < sizeof(ix)))
+		return -1;
+	if ((fseek(rd->fdat, (long)ix.Offset, SEEK_SET) != 0) || (fread(rd->Buf, 1, ix.Size, rd->fdat) != ix.Size))
+		return -1;
+	memcpy(&rec, rd->Buf, sizeof(rec));
+	if ((rec.Magic != HARCH_SLICE_MAGIC) || (rec.Slice != slice))
+		return -1;
+	p = rd->Buf + sizeof(rec);
+	end = rd->Buf + ix.Size;
+	for(ch=0; ch<rd->Hdr.NumCh; ch++) {
+		if ((p = GetVarint(p, end, &nb)) == NULL)
+			return -1;
+		bin = -1;
+		while (nb-- > 0) {
+			if (((p = GetVarint(p, end, &gap)) == NULL) || ((p = GetVarint(p, end, &cnt)) == NULL))
+				return -1;
+			bin += gap;
+			if ((gap == 0) || (bin >= (int)rd->Hdr.Bins))
+				return -1;
+			histo[ch][bin] += cnt;
+		}
+	}
+	return 0;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: sum the slices that overlap the time interval [t0, t1) (ns from the start of the archive)
+//              into histo (cleared first). range gets the interval actually covered by the slices and
+//              the total counts.
+// Return:		number of slices, -1=error
+// ---------------------------------------------------------------------------------------------------------
+int HArchReader_Sum(HArchReader *rd, uint64_t t0, uint64_t t1, uint32_t (*histo)[HARCH_BINS], HArch_Index *range)
+{
+	HArch_Index ix;
+	uint32_t s;
+	int n = 0;
+
+	memset(histo, 0, rd->Hdr.NumCh * HARCH_BINS * sizeof(uint32_t));
+	memset(range, 0, sizeof(HArch_Index));
+	for(s=HArchReader_Find(rd, t0); s<rd->NumSlices; s++) {
+		if (HArchReader_GetIndex(rd, s, &ix) < 0)
+			return -1;
+		if (ix.TStart >= t1)
+			break;
+		if (HArchReader_Add(rd, s, histo) < 0)
+			return -1;
+		if (n == 0) {
+			*range = ix;
+			range->Counts = 0;
+		}
+		range->TEnd = ix.TEnd;
+		range->WallTime = ix.WallTime;
+		range->Counts += ix.Counts;
+		n++;
+	}
+	return n;
+}
+
+
+void HArchReader_Close(HArchReader *rd)
+{
+	if (rd->fdat != NULL) fclose(rd->fdat);
+	if (rd->fidx != NULL) fclose(rd->fidx);
+	if (rd->Buf != NULL) free(rd->Buf);
+	memset(rd, 0, sizeof(HArchReader));
+}
@@ -0,0 +1,314 @@
+/******************************************************************************
+*
+* CAEN SpA - Front End Division
+* Via Vetraia, 11 - 55049 - Viareggio ITALY
+* +390594388398 - www.caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This program is free software; you can redistribute it and/or modify it under
+* the terms of the GNU General Public License as published by the Free Software
+* Foundation. This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "HistFill.h"
+
+#define IDLE_SLEEP_US		50
+
+
+static size_t ShardSize(HistFill *hf)
+{
+	return (size_t)hf->NumCh * hf->Stride;
+}
+
+
+static size_t CalHistoSize(HistFill *hf)
+{
+	return hf->cal != NULL ? (size_t)hf->cal->NumCh * (hf->cal->NumBins + 1) : 0;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: clear the shard of a worker (called by the worker itself)
+// ---------------------------------------------------------------------------------------------------------
+static void ClearShard(HF_Worker *w)
+{
+	memset(w->histo, 0, ShardSize(w->hf) * sizeof(uint32_t));
+	memset(w->ns, 0, sizeof(w->ns));
+	if (w->CalHisto != NULL)
+		memset(w->CalHisto, 0, CalHistoSize(w->hf) * sizeof(uint32_t));
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: fill the shard with a batch. The counters are only written by this thread; the
+//              relaxed atomic stores let the merger read them at any time.
+// ---------------------------------------------------------------------------------------------------------
+static void FillBatch(HF_Worker *w, const QTP_Event *ev, int nev)
+{
+	Calib *cal = w->hf->cal;
+	CalTable *tab = cal != NULL ? __atomic_load_n(&cal->Active, __ATOMIC_SEQ_CST) : NULL;  // one table for the whole batch
+	int Stride = w->hf->Stride, Shift = w->hf->Shift;
+	int e, j;
+
+	for(e=0; e<nev; e++) {
+		uint32_t mask = ev[e].ChMask;
+		while (mask) {
+			uint32_t *h;
+			j = __builtin_ctz(mask);
+			mask &= mask - 1;
+			h = &w->histo[j * Stride + ((ev[e].Data[j] & 0xFFF) >> Shift)];
+			__atomic_store_n(h, *h + 1, __ATOMIC_RELAXED);
+			__atomic_store_n(&w->ns[j], w->ns[j] + 1, __ATOMIC_RELAXED);
+			if ((cal != NULL) && (j < cal->NumCh)) {
+				uint32_t *c = &w->CalHisto[j * (cal->NumBins + 1) + tab->Bin[j][ev[e].Data[j] & 0xFFF]];
+				__atomic_store_n(c, *c + 1, __ATOMIC_RELAXED);
+			}
+		}
+	}
+	w->NumEvents += nev;
+}
+
+
+static void *WorkerThread(void *arg)
+{
+	HF_Worker *w = (HF_Worker *)arg;
+	HistFill *hf = w->hf;
+
+	while (1) {
+		unsigned t = w->tail;
+		unsigned epoch;
+		HF_Batch *b;
+
+		if (__atomic_load_n(&w->head, __ATOMIC_ACQUIRE) == t) {
+			if (hf->Quit)
+				break;
+			usleep(IDLE_SLEEP_US);
+			continue;
+		}
+		b = &w->slot[t % HF_RING_SIZE];
+		epoch = __atomic_load_n(&hf->Epoch, __ATOMIC_ACQUIRE);
+		if (w->Epoch != epoch) {
+			ClearShard(w);
+			__atomic_store_n(&w->Epoch, epoch, __ATOMIC_RELEASE);
+		}
+		if (b->Epoch == epoch)  // batches decoded before a reset are dropped
+			FillBatch(w, b->ev, b->nev);
+		if (b->blk != NULL)
+			BufPool_Release(b->blk);
+		__atomic_store_n(&w->tail, t + 1, __ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: start NumWorkers fill threads, each one with its own histogram shard of NumCh channels
+//              of Bins bins (power of 2, as in the HistoSet they are merged into)
+// Return:		0=OK, -1=error
+// ---------------------------------------------------------------------------------------------------------
+int HistFill_Init(HistFill *hf, int NumWorkers, int NumCh, int Bins, Calib *cal)
+{
+	int i;
+
+	memset(hf, 0, sizeof(HistFill));
+	hf->NumCh = NumCh < QTP_MAX_CH ? NumCh : QTP_MAX_CH;
+	for(hf->Bins = HISTO_MAX_BINS; (hf->Bins > Bins) && (hf->Bins > 16); hf->Bins >>= 1)
+		hf->Shift++;
+	hf->Stride = hf->Bins + HF_CACHE_LINE / sizeof(uint32_t);
+	if ((hf->Row = (uint64_t *)malloc(hf->Bins * sizeof(uint64_t))) == NULL)
+		return -1;
+	hf->cal = cal;
+	if (NumWorkers > HF_MAX_WORKERS)
+		NumWorkers = HF_MAX_WORKERS;
+	for(i=0; i<NumWorkers; i++) {
+		HF_Worker *w;
+		if (posix_memalign((void **)&w, HF_CACHE_LINE, sizeof(HF_Worker)) != 0)
+			break;
+		memset(w, 0, sizeof(HF_Worker));
+		w->hf = hf;
+		hf->w[i] = w;
+		hf->NumWorkers = i + 1;
+		if (posix_memalign((void **)&w->histo, HF_CACHE_LINE, ShardSize(hf) * sizeof(uint32_t)) != 0) {
+			w->histo = NULL;
+			break;
+		}
+		if ((cal != NULL) && (posix_memalign((void **)&w->CalHisto, HF_CACHE_LINE, CalHistoSize(hf) * sizeof(uint32_t)) != 0)) {
+			w->CalHisto = NULL;
+			break;
+		}
+		w->Seen = (uint32_t *)calloc(ShardSize(hf), sizeof(uint32_t));
+		w->CalSeen = cal != NULL ? (uint32_t *)calloc(CalHistoSize(hf), sizeof(uint32_t)) : NULL;
+		if ((w->Seen == NULL) || ((cal != NULL) && (w->CalSeen == NULL)))
+			break;
+		ClearShard(w);
+		if (pthread_create(&w->thread, NULL, WorkerThread, w) != 0)
+			break;
+	}
+	if (i < NumWorkers) {
+		printf("Can't start the histogram fill threads\n");
+		HistFill_Close(hf);
+		return -1;
+	}
+	return 0;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: queue a batch of events to the next worker (round robin). If its ring is full, the
+//              batch goes to the first worker with a free slot; if all the rings are full, wait.
+//              The events are read in place: they must not be modified until the worker releases
+//              blk (the block they belong to, retained here). With blk = NULL they must stay valid
+//              until HistFill_Flush.
+// ---------------------------------------------------------------------------------------------------------
+void HistFill_Submit(HistFill *hf, const QTP_Event *ev, int nev, BufPool_Block *blk)
+{
+	HF_Worker *w;
+	HF_Batch *b;
+	int i;
+
+	if (nev <= 0)
+		return;
+	while (1) {
+		for(i=0; i<hf->NumWorkers; i++) {
+			w = hf->w[(hf->next + i) % hf->NumWorkers];
+			if ((w->head - __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE)) < HF_RING_SIZE)
+				break;
+		}
+		if (i < hf->NumWorkers)
+			break;
+		sched_yield();
+	}
+	hf->next = (hf->next + i + 1) % hf->NumWorkers;
+	b = &w->slot[w->head % HF_RING_SIZE];
+	if (blk != NULL)
+		BufPool_Retain(blk);
+	b->ev = ev;
+	b->nev = nev;
+	b->blk = blk;
+	b->Epoch = hf->Epoch;
+	__atomic_store_n(&w->head, w->head + 1, __ATOMIC_RELEASE);
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: start a new epoch. Each worker clears its own shard before the next batch; until
+//              then the merger ignores it, so the combined view is empty right after the reset.
+// ---------------------------------------------------------------------------------------------------------
+void HistFill_Reset(HistFill *hf)
+{
+	__atomic_add_fetch(&hf->Epoch, 1, __ATOMIC_ACQ_REL);
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: add to histo and ns[] (and to the calibrated histograms) what the workers have filled
+//              since the previous merge: the increments of the 32 bit shard counters (modulo 2^32,
+//              so a counter can wrap between two merges once). The workers are not stopped.
+//              histo, ns[] and the calibrated histograms are cleared by the caller at each reset
+//              (HistFill_Reset, which must not run during a merge); the shards of the previous epoch
+//              are skipped until their workers clear them.
+// ---------------------------------------------------------------------------------------------------------
+void HistFill_Merge(HistFill *hf, HistoSet *histo, int *ns)
+{
+	unsigned epoch = __atomic_load_n(&hf->Epoch, __ATOMIC_ACQUIRE);
+	size_t ncal = CalHistoSize(hf);
+	size_t k;
+	int i, j, ch;
+
+	for(i=0; i<hf->NumWorkers; i++) {
+		HF_Worker *w = hf->w[i];
+		if (__atomic_load_n(&w->Epoch, __ATOMIC_ACQUIRE) != epoch)
+			continue;
+		if (w->SeenEpoch != epoch) {  // the worker has cleared its shard
+			memset(w->Seen, 0, ShardSize(hf) * sizeof(uint32_t));
+			memset(w->NsSeen, 0, sizeof(w->NsSeen));
+			if (ncal > 0)
+				memset(w->CalSeen, 0, ncal * sizeof(uint32_t));
+			w->SeenEpoch = epoch;
+		}
+		for(ch=0; ch<hf->NumCh; ch++) {
+			uint32_t *src = &w->histo[ch * hf->Stride];
+			uint32_t *seen = &w->Seen[ch * hf->Stride];
+			for(j=0; j<hf->Bins; j++) {
+				uint32_t c = __atomic_load_n(&src[j], __ATOMIC_RELAXED);
+				hf->Row[j] = c - seen[j];
+				seen[j] = c;
+			}
+			Histo_AddRow(histo, ch, hf->Row);
+		}
+		for(j=0; j<QTP_MAX_CH; j++) {
+			uint32_t c = __atomic_load_n(&w->ns[j], __ATOMIC_RELAXED);
+			ns[j] += (int)(c - w->NsSeen[j]);
+			w->NsSeen[j] = c;
+		}
+		for(k=0; k<ncal; k++) {
+			uint32_t c = __atomic_load_n(&w->CalHisto[k], __ATOMIC_RELAXED);
+			hf->cal->CalHisto[k] += c - w->CalSeen[k];
+			w->CalSeen[k] = c;
+		}
+	}
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: wait until all the queued batches have been filled
+// ---------------------------------------------------------------------------------------------------------
+void HistFill_Flush(HistFill *hf)
+{
+	int i;
+	for(i=0; i<hf->NumWorkers; i++) {
+		HF_Worker *w = hf->w[i];
+		while (__atomic_load_n(&w->tail, __ATOMIC_ACQUIRE) != w->head)
+			sched_yield();
+	}
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: wait until the batches being filled when it is called have been completed (the
+//              following ones see the calibration table swapped before the call)
+// ---------------------------------------------------------------------------------------------------------
+void HistFill_Sync(HistFill *hf)
+{
+	int i;
+	for(i=0; i<hf->NumWorkers; i++) {
+		HF_Worker *w = hf->w[i];
+		unsigned t = __atomic_load_n(&w->tail, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&w->head, __ATOMIC_SEQ_CST) == t)
+			continue;
+		while (__atomic_load_n(&w->tail, __ATOMIC_ACQUIRE) == t)
+			sched_yield();
+	}
+}
+
+
+void HistFill_Close(HistFill *hf)
+{
+	int i;
+
+	hf->Quit = 1;
+	for(i=0; i<hf->NumWorkers; i++) {
+		HF_Worker *w = hf->w[i];
+		if (w == NULL)
+			continue;
+		if (w->thread)
+			pthread_join(w->thread, NULL);
+		if (w->histo != NULL) free(w->histo);
+		if (w->CalHisto != NULL) free(w->CalHisto);
+		if (w->Seen != NULL) free(w->Seen);
+		if (w->CalSeen != NULL) free(w->CalSeen);
+		free(w);
+	}
+	if (hf->Row != NULL) free(hf->Row);
+	memset(hf, 0, sizeof(HistFill));
+}
@@ -0,0 +1,213 @@
+/******************************************************************************
+*
+* CAEN SpA - Front End Division
+* Via Vetraia, 11 - 55049 - Viareggio ITALY
+* +390594388398 - www.caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This program is free software; you can redistribute it and/or modify it under
+* the terms of the GNU General Public License as published by the Free Software
+* Foundation. This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Histo.h"
+
+#define SAVE_BUFFER_SIZE		(64*1024)
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: allocate the histograms of NumCh channels. Bins is rounded to a power of 2 between 16 and
+//              4096.
+// Return:		0=OK, -1=error
+// ---------------------------------------------------------------------------------------------------------
+int Histo_Init(HistoSet *h, int NumCh, int Bins)
+{
+	int ch;
+
+	memset(h, 0, sizeof(HistoSet));
+	h->NumCh = NumCh < QTP_MAX_CH ? NumCh : QTP_MAX_CH;
+	h->Bins = HISTO_MAX_BINS;
+	while ((h->Bins > Bins) && (h->Bins > 16)) {
+		h->Bins >>= 1;
+		h->Shift++;
+	}
+	if (posix_memalign((void **)&h->Lo, HISTO_ALIGN, (size_t)h->NumCh * (h->Bins + HISTO_ROW_PAD) * sizeof(uint16_t)) != 0) {
+		h->Lo = NULL;
+		return -1;
+	}
+	for(ch=0; ch<h->NumCh; ch++)
+		h->Row[ch] = h->Lo + (size_t)ch * (h->Bins + HISTO_ROW_PAD);
+	Histo_Reset(h);
+	return 0;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: start using the high words of a channel (allocated once, kept after a reset)
+// Return:		0=OK, -1=can't allocate the high words
+// ---------------------------------------------------------------------------------------------------------
+static int Widen(HistoSet *h, int ch)
+{
+	if (h->WideMask & (1u << ch))
+		return 0;
+	if ((h->Hi[ch] == NULL) && ((h->Hi[ch] = (uint32_t *)malloc(h->Bins * sizeof(uint32_t))) == NULL))
+		return -1;
+	memset(h->Hi[ch], 0, h->Bins * sizeof(uint32_t));
+	h->WideMask |= 1u << ch;
+	return 0;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: a bin has just wrapped to 0: add the carry to its high word (without memory, the bin
+//              stays at the max value)
+// ---------------------------------------------------------------------------------------------------------
+void Histo_Carry(HistoSet *h, int ch, int bin)
+{
+	if (Widen(h, ch) < 0) {
+		h->Row[ch][bin] = 0xFFFF;
+		h->Lost++;
+		return;
+	}
+	h->Hi[ch][bin]++;
+	h->Overflows++;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: fill the histograms with a batch of events and count the values of each channel in ns[]
+// ---------------------------------------------------------------------------------------------------------
+void Histo_FillEvents(HistoSet *h, const QTP_Event *ev, int nev, int *ns)
+{
+	uint16_t *row[QTP_MAX_CH];
+	int Shift = h->Shift;
+	int e, j;
+
+	memcpy(row, h->Row, sizeof(row));  // not reloaded after each store
+	for(e=0; e<nev; e++) {
+		uint32_t mask = ev[e].ChMask;
+		while (mask) {
+			int bin;
+			j = __builtin_ctz(mask);
+			mask &= mask - 1;
+			bin = (ev[e].Data[j] & (HISTO_MAX_BINS - 1)) >> Shift;
+			if (__builtin_expect(++row[j][bin] == 0, 0))
+				Histo_Carry(h, j, bin);
+			ns[j]++;
+		}
+	}
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: clear all the histograms (NumCh x Bins 16 bit counters; the high words are only
+//              marked as unused and cleared at the next overflow)
+// ---------------------------------------------------------------------------------------------------------
+void Histo_Reset(HistoSet *h)
+{
+	memset(h->Lo, 0, (size_t)h->NumCh * (h->Bins + HISTO_ROW_PAD) * sizeof(uint16_t));
+	h->WideMask = 0;
+	h->Lost = 0;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: add the counts of a row (Bins values) to the histogram of a channel, e.g. to merge the
+//              shards of the fill threads
+// ---------------------------------------------------------------------------------------------------------
+void Histo_AddRow(HistoSet *h, int ch, const uint64_t *counts)
+{
+	uint16_t *lo = h->Row[ch];
+	int i;
+
+	for(i=0; i<h->Bins; i++) {
+		uint32_t c = lo[i] + (uint32_t)(counts[i] & 0xFFFF);
+		uint32_t carry = (uint32_t)(counts[i] >> 16) + (c >> 16);
+		lo[i] = (uint16_t)c;
+		if (carry == 0)
+			continue;
+		if (Widen(h, ch) < 0) {
+			lo[i] = 0xFFFF;
+			h->Lost += carry;
+			continue;
+		}
+		h->Hi[ch][i] += carry;
+		h->Overflows += carry;
+	}
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: copy the counts of a channel (Bins values, saturated to 32 bit)
+// ---------------------------------------------------------------------------------------------------------
+void Histo_Snapshot(const HistoSet *h, int ch, uint32_t *out)
+{
+	const uint16_t *lo = h->Row[ch];
+	int i;
+
+	if (!(h->WideMask & (1u << ch))) {
+		for(i=0; i<h->Bins; i++)
+			out[i] = lo[i];
+		return;
+	}
+	for(i=0; i<h->Bins; i++) {
+		uint64_t c = lo[i] + ((uint64_t)h->Hi[ch][i] << 16);
+		out[i] = c > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)c;
+	}
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: write the histogram of a channel to a text file (one line per bin)
+// Return:		0=OK, -1=error
+// ---------------------------------------------------------------------------------------------------------
+int Histo_Save(const HistoSet *h, int ch, const char *FileName)
+{
+	char buf[SAVE_BUFFER_SIZE];
+	FILE *fout;
+	int i, n = 0, ret = 0;
+
+	if ((fout = fopen(FileName, "w")) == NULL)
+		return -1;
+	for(i=0; i<h->Bins; i++) {
+		char tmp[24];
+		uint64_t v = Histo_GetBin(h, ch, i);
+		int k = 0;
+		do {
+			tmp[k++] = (char)('0' + v % 10);
+			v /= 10;
+		} while (v > 0);
+		while (k > 0)
+			buf[n++] = tmp[--k];
+		buf[n++] = '\n';
+		if (n > SAVE_BUFFER_SIZE - 32) {
+			if (fwrite(buf, 1, n, fout) != (size_t)n)
+				ret = -1;
+			n = 0;
+		}
+	}
+	if ((n > 0) && (fwrite(buf, 1, n, fout) != (size_t)n))
+		ret = -1;
+	if (fclose(fout) != 0)
+		ret = -1;
+	return ret;
+}
+
+
+void Histo_Close(HistoSet *h)
+{
+	int ch;
+
+	for(ch=0; ch<QTP_MAX_CH; ch++)
+		if (h->Hi[ch] != NULL) free(h->Hi[ch]);
+	if (h->Lo != NULL) free(h->Lo);
+	memset(h, 0, sizeof(HistoSet));
+}
@@ -0,0 +1,1424 @@
+/******************************************************************************
+*
+* CAEN SpA - Front End Division
+* Via Vetraia, 11 - 55049 - Viareggio ITALY
+* +390594388398 - www.caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This program is free software; you can redistribute it and/or modify it under
+* the terms of the GNU General Public License as published by the Free Software
+* Foundation. This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#define _GNU_SOURCE		// pthread_setaffinity_np
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include <CAENVMElib.h>
+
+#include "QTPD.h"
+
+//#define ENABLE_LOG			0
+#define ENABLE_LOG			1
+
+
+/*******************************************************************************/
+/*                               READ_REG                                      */
+/*******************************************************************************/
+uint16_t QTPD_ReadReg(QTPD_Board *b, uint16_t reg_addr)
+{
+	uint16_t data=0;
+	CVErrorCodes ret;
+	ret = CAENVME_ReadCycle(b->handle, b->BaseAddress + reg_addr, &data, cvA32_U_DATA, cvD16);
+	if(ret != cvSuccess) {
+		sprintf(b->ErrorString, "Cannot read at address %08X\n", (uint32_t)(b->BaseAddress + reg_addr));
+		b->VMEerror = 1;
+	}
+	if (ENABLE_LOG && (b->logfile != NULL))
+		fprintf(b->logfile, " Reading register at address %08X; data=%04X; ret=%d\n", (uint32_t)(b->BaseAddress + reg_addr), data, (int)ret);
+	return(data);
+}
+
+
+
+/*******************************************************************************/
+/*                                WRITE_REG                                    */
+/*******************************************************************************/
+void QTPD_WriteReg(QTPD_Board *b, uint16_t reg_addr, uint16_t data)
+{
+	CVErrorCodes ret;
+	ret = CAENVME_WriteCycle(b->handle, b->BaseAddress + reg_addr, &data, cvA32_U_DATA, cvD16);
+	if(ret != cvSuccess) {
+		sprintf(b->ErrorString, "Cannot write at address %08X\n", (uint32_t)(b->BaseAddress + reg_addr));
+		b->VMEerror = 1;
+	}
+	if (ENABLE_LOG && (b->logfile != NULL))
+		fprintf(b->logfile, " Writing register at address %08X; data=%04X; ret=%d\n", (uint32_t)(b->BaseAddress + reg_addr), data, (int)ret);
+}
+
+
+
+/*******************************************************************************/
+/*                           READ_REGS / WRITE_REGS                            */
+/*******************************************************************************/
+// n registers of the board being accessed, in a single call to the VME bridge
+// (at most QTPD_MAX_MULTI cycles)
+static int MultiCycle(QTPD_Board *b, const uint16_t *reg_addr, uint16_t *data, int n, int Write)
+{
+	uint32_t addr[QTPD_MAX_MULTI], buf[QTPD_MAX_MULTI];
+	CVAddressModifier am[QTPD_MAX_MULTI];
+	CVDataWidth dw[QTPD_MAX_MULTI];
+	CVErrorCodes ec[QTPD_MAX_MULTI];
+	int i;
+
+	if (n > QTPD_MAX_MULTI)
+		return -1;
+	for(i=0; i<n; i++) {
+		addr[i] = b->BaseAddress + reg_addr[i];
+		buf[i] = Write ? data[i] : 0;
+		am[i] = cvA32_U_DATA;
+		dw[i] = cvD16;
+		ec[i] = cvSuccess;
+	}
+	if (Write)
+		CAENVME_MultiWrite(b->handle, addr, buf, n, am, dw, ec);
+	else
+		CAENVME_MultiRead(b->handle, addr, buf, n, am, dw, ec);
+	for(i=0; i<n; i++) {
+		if (!Write)
+			data[i] = (uint16_t)buf[i];
+		if (ec[i] != cvSuccess) {
+			sprintf(b->ErrorString, "Cannot %s at address %08X\n", Write ? "write" : "read", addr[i]);
+			b->VMEerror = 1;
+		}
+		if (ENABLE_LOG && (b->logfile != NULL))
+			fprintf(b->logfile, " %s register at address %08X; data=%04X; ret=%d\n", Write ? "Writing" : "Reading",
+				addr[i], (uint16_t)buf[i], (int)ec[i]);
+	}
+	return b->VMEerror ? -1 : 0;
+}
+
+int QTPD_ReadRegs(QTPD_Board *b, const uint16_t *reg_addr, uint16_t *data, int n)
+{
+	int i, ret = 0;
+	for(i=0; i<n; i+=QTPD_MAX_MULTI)
+		ret |= MultiCycle(b, reg_addr + i, data + i, n - i < QTPD_MAX_MULTI ? n - i : QTPD_MAX_MULTI, 0);
+	return ret;
+}
+
+int QTPD_WriteRegs(QTPD_Board *b, const uint16_t *reg_addr, const uint16_t *data, int n)
+{
+	int i, ret = 0;
+	for(i=0; i<n; i+=QTPD_MAX_MULTI)
+		ret |= MultiCycle(b, reg_addr + i, (uint16_t *)data + i, n - i < QTPD_MAX_MULTI ? n - i : QTPD_MAX_MULTI, 1);
+	return ret;
+}
+
+
+
+// ************************************************************************
+// Discriminitor settings
+// ************************************************************************
+static int ConfigureDiscr(QTPD_Board *b, uint16_t OutputWidth, uint16_t Threshold[16], uint16_t EnableMask)
+{
+	uint16_t addr[19], data[19];
+	int i, ret;
+
+	b->BaseAddress = b->Link.DiscrBaseAddr;
+	// set CFD threshold
+	for(i=0; i<16; i++) {
+		addr[i] = i*2;
+		data[i] = Threshold[i];
+	}
+	// set output width (same for all channels)
+	addr[16] = 0x0040;
+	addr[17] = 0x0042;
+	data[16] = data[17] = OutputWidth;
+	// Set channel mask
+	addr[18] = 0x004A;
+	data[18] = EnableMask;
+	QTPD_WriteRegs(b, addr, data, 19);
+
+	if (b->VMEerror) {
+		printf("Error during CFD programming: ");
+		printf("%s", b->ErrorString);
+		b->VMEerror = 0;
+		ret = -1;
+	} else {
+		printf("Discriminator programmed successfully\n");
+		ret = 0;
+	}
+	b->BaseAddress = b->Link.QTPBaseAddr;
+	return ret;
+}
+
+
+static void findModelVersion(uint16_t model, uint16_t vers, char *modelVersion, int *ch) {
+	switch (model) {
+	case 792:
+		switch (vers) {
+		case 0x11:
+			strcpy(modelVersion, "AA");
+			*ch = 32;
+			return;
+		case 0x13:
+			strcpy(modelVersion, "AC");
+			*ch = 32;
+			return;
+		case 0xE1:
+			strcpy(modelVersion, "NA");
+			*ch = 16;
+			return;
+		case 0xE3:
+			strcpy(modelVersion, "NC");
+			*ch = 16;
+			return;
+		default:
+			strcpy(modelVersion, "-");
+			*ch = 32;
+			return;
+		}
+		break;
+	case 965:
+		switch (vers) {
+		case 0x1E:
+			strcpy(modelVersion, "A");
+			*ch = 16;
+			return;
+		case 0xE3:
+		case 0xE1:
+			strcpy(modelVersion, " ");
+			*ch = 32;
+			return;
+		default:
+			strcpy(modelVersion, "-");
+			*ch = 32;
+			return;
+		}
+		break;
+	case 775:
+		switch (vers) {
+		case 0x11:
+			strcpy(modelVersion, "AA");
+			*ch = 32;
+			return;
+		case 0x13:
+			strcpy(modelVersion, "AC");
+			*ch = 32;
+			return;
+		case 0xE1:
+			strcpy(modelVersion, "NA");
+			*ch = 16;
+			return;
+		case 0xE3:
+			strcpy(modelVersion, "NC");
+			*ch = 16;
+			return;
+		default:
+			strcpy(modelVersion, "-");
+			*ch = 32;
+			return;
+		}
+		break;
+	case 785:
+		switch (vers) {
+		case 0x11:
+			strcpy(modelVersion, "AA");
+			*ch = 32;
+			return;
+		case 0x12:
+			strcpy(modelVersion, "Ab");
+			*ch = 32;
+			return;
+		case 0x13:
+			strcpy(modelVersion, "AC");
+			*ch = 32;
+			return;
+		case 0x14:
+			strcpy(modelVersion, "AD");
+			*ch = 32;
+			return;
+		case 0x15:
+			strcpy(modelVersion, "AE");
+			*ch = 32;
+			return;
+		case 0x16:
+			strcpy(modelVersion, "AF");
+			*ch = 32;
+			return;
+		case 0x17:
+			strcpy(modelVersion, "AG");
+			*ch = 32;
+			return;
+		case 0x18:
+			strcpy(modelVersion, "AH");
+			*ch = 32;
+			return;
+		case 0x1B:
+			strcpy(modelVersion, "AK");
+			*ch = 32;
+			return;
+		case 0xE1:
+			strcpy(modelVersion, "NA");
+			*ch = 16;
+			return;
+		case 0xE2:
+			strcpy(modelVersion, "NB");
+			*ch = 16;
+			return;
+		case 0xE3:
+			strcpy(modelVersion, "NC");
+			*ch = 16;
+			return;
+		case 0xE4:
+			strcpy(modelVersion, "ND");
+			*ch = 16;
+			return;
+		default:
+			strcpy(modelVersion, "-");
+			*ch = 32;
+			return;
+		}
+		break;
+	case 862:
+		switch (vers) {
+		case 0x11:
+			strcpy(modelVersion, "AA");
+			*ch = 32;
+			return;
+		case 0x13:
+			strcpy(modelVersion, "AC");
+			*ch = 32;
+			return;
+		default:
+			strcpy(modelVersion, "-");
+			*ch = 32;
+			return;
+		}
+		break;
+	}
+}
+
+
+// ************************************************************************
+// Save Histograms to files
+// ************************************************************************
+static int SaveHistograms(const HistoSet *histo, const char *DataPath, const char *name)
+{
+	int j;
+	for(j=0; j<histo->NumCh; j++) {
+		char fname[300];
+		sprintf(fname, "%sV792nQDC_%s_%d.txt",DataPath, name, j);
+		if (Histo_Save(histo, j, fname) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+
+#define QUEUE_WAIT_MS		10		// max wait of QTPD_Read for the blocks of the link threads
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: grace period after a load of the calibration: wait until the fill path (the block being
+//              processed or the batches of the fill threads) no longer uses the replaced table, then
+//              free it
+// ---------------------------------------------------------------------------------------------------------
+static void RetireCalib(QTPD_Board *b)
+{
+	unsigned in = __atomic_load_n(&b->CalIn, __ATOMIC_SEQ_CST);
+
+	if (b->Cal.Retired == NULL)
+		return;
+	if (b->HFill.NumWorkers > 0)
+		HistFill_Sync(&b->HFill);
+	else
+		while ((int)(__atomic_load_n(&b->CalOut, __ATOMIC_ACQUIRE) - in) < 0)
+			sched_yield();
+	Calib_FreeRetired(&b->Cal);
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: allocate the readout buffers, the views and the 2D histograms of a board
+// Return:		0=OK, -1=error
+// ---------------------------------------------------------------------------------------------------------
+static int AllocBuffers(QTPD_Board *b, QTPD_Config *cfg)
+{
+	int i;
+
+	if (BufPool_Init(&b->Pool, cfg->BltBufferCount, cfg->BltBufferSize, cfg->BltHugePages, cfg->BltLockMemory) < 0)
+		return -1;
+	BltSizer_Init(&b->Sizer, cfg->BltMinSize, b->Pool.BlockSize, cfg->BltAdaptive);
+	b->MaxEvents = b->Pool.BlockSize / 8 + 1;  // an event takes at least 2 words
+	b->Views = (QTPD_View *)calloc(b->Pool.NumBlocks, sizeof(QTPD_View));
+	b->EvBuf = (QTP_Event *)malloc((size_t)b->Pool.NumBlocks * b->MaxEvents * sizeof(QTP_Event));
+	if (cfg->FillThreads > 0)  // the workers read EvBuf until they release the block
+		b->SuppBuf = (QTP_Event *)malloc((size_t)b->Pool.NumBlocks * b->MaxEvents * sizeof(QTP_Event));
+	if ((b->Views == NULL) || (b->EvBuf == NULL) || ((cfg->FillThreads > 0) && (b->SuppBuf == NULL))) {
+		printf("Can't allocate the event buffers\n");
+		return -1;
+	}
+	for(i=0; i<b->Pool.NumBlocks; i++) {
+		b->Views[i].ev = b->EvBuf + (size_t)i * b->MaxEvents;
+		b->Views[i].sel = (int *)malloc(b->MaxEvents * sizeof(int));
+		b->Views[i].blk = &b->Pool.blocks[i];
+		b->Views[i].Board = b->Index;
+		if (b->Views[i].sel == NULL) {
+			printf("Can't allocate the event buffers\n");
+			return -1;
+		}
+	}
+	for(i=0; i<cfg->NumHist2D; i++) {
+		if (Hist2D_Add(&b->H2, cfg->Hist2DPairs[i][0], cfg->Hist2DPairs[i][1], cfg->Hist2DPairs[i][2], cfg->Hist2DMaxTiles) < 0)
+			printf("Can't add the 2D histogram ch%d vs ch%d\n", cfg->Hist2DPairs[i][0], cfg->Hist2DPairs[i][1]);
+	}
+	Filter_Compile(&b->Flt, &cfg->Select);
+	Suppressor_Init(&b->Supp, cfg->SwSuppression, cfg->SwThreshold, cfg->SwKeepOverflow);
+	return 0;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: open the VME link k, program its discriminator (if present), reset and identify its
+//              QTP board, allocate buffers and histograms
+// Return:		0=OK, -1=error
+// ---------------------------------------------------------------------------------------------------------
+static int OpenBoard(QTPD *q, int k)
+{
+	QTPD_Config *c = &q->cfg;
+	QTPD_Board *b;
+	int ret;
+
+	if ((b = (QTPD_Board *)calloc(1, sizeof(QTPD_Board))) == NULL)
+		return -1;
+	q->Board[k] = b;
+	q->NumBoards = k + 1;
+	b->Index = k;
+	b->Link = c->Link[k];
+	b->handle = -1;
+	b->q = q;
+	pthread_mutex_init(&b->Lock, NULL);
+	if (k == 0)
+		strcpy(b->Prefix, c->DataPath);
+	else
+		sprintf(b->Prefix, "%sB%d_", c->DataPath, k);
+	if (c->NumLinks > 1)
+		printf("Link %d:\n", k);
+
+	if (AllocBuffers(b, c) < 0)
+		return -1;
+
+	// open VME bridge
+	if (b->Link.LinkType == cvETH_V4718)
+		ret = CAENVME_Init2(b->Link.LinkType, b->Link.LinkIp, b->Link.ConetNode, &b->handle);
+	else
+		ret = CAENVME_Init2(b->Link.LinkType, &b->Link.LinkPid, b->Link.ConetNode, &b->handle);
+	if (ret != cvSuccess) {
+		printf("Can't open VME controller\n");
+		b->handle = -1;
+		return -1;
+	}
+
+	// Program the discriminator (if the base address is set in the config file)
+	if (b->Link.DiscrBaseAddr > 0) {
+		printf("Discr Base Address = 0x%08X\n", b->Link.DiscrBaseAddr);
+		if (ConfigureDiscr(b, c->DiscrOutputWidth, c->DiscrThreshold, c->DiscrChMask) < 0) {
+			printf("Can't access to the discriminator at Base Address 0x%08X\n", b->Link.DiscrBaseAddr);
+			printf("Skipping Discriminator configuration\n");
+		}
+	}
+	b->Image.DiscrChMask = c->DiscrChMask;
+	b->Image.DiscrOutputWidth = c->DiscrOutputWidth;
+	memcpy(b->Image.DiscrThreshold, c->DiscrThreshold, sizeof(b->Image.DiscrThreshold));
+
+	// Check if the base address of the QTP board has been set (otherwise exit)
+	if (b->Link.QTPBaseAddr == 0) {
+		printf("No Base Address setting found for the QTP board.\n");
+		printf("Skipping QTP readout\n");
+		return -1;
+	}
+	printf("QTP Base Address = 0x%08X\n", b->Link.QTPBaseAddr);
+	b->BaseAddress = b->Link.QTPBaseAddr;
+
+	// Open log file (for debugging)
+	if (ENABLE_LOG) {
+		char tmp[255];
+		sprintf(tmp, "%sV792nQDC_log.txt", b->Prefix);
+		printf("Log file is enabled\n");
+		b->logfile = fopen(tmp,"w");
+	}
+
+	// Reset QTP board
+	QTPD_WriteReg(b, 0x1016, 0);
+	if (b->VMEerror) {
+		printf("Error during QTP programming: ");
+		printf("%s", b->ErrorString);
+		return -1;
+	}
+
+	// Read FW revision
+	b->FwRev = QTPD_ReadReg(b, 0x1000);
+	if (b->VMEerror) {
+		printf("%s", b->ErrorString);
+		return -1;
+	}
+
+	b->Model = (QTPD_ReadReg(b, 0x803E) & 0xFF) + ((QTPD_ReadReg(b, 0x803A) & 0xFF) << 8);
+	// read version (> 0xE0 = 16 channels)
+	b->Version = QTPD_ReadReg(b, 0x8032) & 0xFF;
+	b->NumCh = 32;
+	findModelVersion(b->Model, b->Version, b->ModelVersion, &b->NumCh);
+	printf("Model = V%d%s\n", b->Model, b->ModelVersion);
+
+	// Read serial number
+	b->SerNum = (QTPD_ReadReg(b, 0x8F06) & 0xFF) + ((QTPD_ReadReg(b, 0x8F02) & 0xFF) << 8);
+	printf("Serial Number = %d\n", b->SerNum);
+	printf("FW Revision = %d.%d\n", (b->FwRev >> 8) & 0xFF, b->FwRev & 0xFF);
+
+	if (c->EnableStatsFile) {
+		char tmp[255];
+		sprintf(tmp, "%sV792nQDC_Stats.txt", b->Prefix);
+		if ((b->StatsFile = fopen(tmp, "w")) == NULL)
+			printf("Can't open statistics file for writing\n");
+	}
+	Stats_Init(&b->ChStats, b->NumCh, QTPD_LSB2PHY, c->PedWindow, c->PedTrackDepth, c->PeakHalfWidth, b->StatsFile);
+	Decoder_Init(&b->Dec, b->NumCh);
+	// 1D histograms sized to the channels of the model
+	if ((Histo_Init(&b->histo, b->NumCh, c->HistoBins) < 0) ||
+		(b->Flt.Enabled && (Histo_Init(&b->GatedHisto, b->NumCh, c->HistoBins) < 0))) {
+		printf("Can't allocate the histograms\n");
+		return -1;
+	}
+	if (c->EnableCalib) {
+		if (Calib_Init(&b->Cal, b->NumCh, c->CalHistoBins, c->CalHistoMin, c->CalHistoMax, QTPD_LSB2PHY) < 0) {
+			printf("Can't allocate the calibration tables; calibrated histograms disabled\n");
+			c->EnableCalib = 0;
+		} else if (c->CalibFileName[0] != 0) {
+			if (Calib_Load(&b->Cal, c->CalibFileName) == 0)
+				printf("Calibration loaded from %s\n", c->CalibFileName);
+			RetireCalib(b);
+		}
+	}
+	if (c->FillThreads > 0) {
+		if (HistFill_Init(&b->HFill, c->FillThreads, b->NumCh, b->histo.Bins, c->EnableCalib ? &b->Cal : NULL) < 0)
+			return -1;
+		printf("Histograms filled by %d threads\n", b->HFill.NumWorkers);
+	}
+	if (c->HistoArchiveInterval > 0) {
+		char tmp[255];
+		sprintf(tmp, "%sV792nQDC_HistoArchive", b->Prefix);
+		if (HistArchive_Open(&b->Arch, tmp, b->NumCh, b->histo.Bins, c->HistoArchiveInterval * 1000, q->ArchiveStart) < 0)
+			printf("Can't open the histogram archive for writing\n");
+	}
+	return 0;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: open the VME links and the boards (see OpenBoard)
+// Return:		0=OK, -1=error
+// ---------------------------------------------------------------------------------------------------------
+int QTPD_Open(QTPD *q, const QTPD_Config *cfg)
+{
+	QTPD_Config *c = &q->cfg;
+	int k;
+
+	memset(q, 0, sizeof(QTPD));
+	q->cfg = *cfg;
+	pthread_mutex_init(&q->QueueLock, NULL);
+	pthread_cond_init(&q->QueueCond, NULL);
+
+	if (Timer_Init(c->TimerSource) == TIMER_SOURCE_TSC)
+		printf("Time stamps from the TSC (%.3f GHz)\n", Timer_TicksPerNs());
+	q->ArchiveStart = Timer_Now();  // not RunStart: the archives are not restarted by QTPD_Start
+	if ((c->NumLinks < 1) || (c->NumLinks > QTPD_MAX_LINKS))
+		c->NumLinks = 1;
+	for(k=0; k<c->NumLinks; k++) {
+		if (OpenBoard(q, k) < 0)
+			goto OpenError;
+		q->QueueSize += q->Board[k]->Pool.NumBlocks;
+	}
+
+	// one readout thread per link when there are more links, the readout is pinned to a core or the
+	// pool has more buffers (the next block transfer overlaps the processing of the previous block);
+	// each block of the pools can be in the queue only once
+	q->Threaded = (c->NumLinks > 1) || (c->Link[0].Core >= 0) || (q->Board[0]->Pool.NumBlocks > 1);
+	if (q->Threaded) {
+		q->Queue = (const QTPD_View **)calloc(q->QueueSize, sizeof(QTPD_View *));
+		if (q->Queue == NULL)
+			goto OpenError;
+	}
+	return 0;
+
+OpenError:
+	QTPD_Close(q);
+	return -1;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: register values of the settings of a board
+// ---------------------------------------------------------------------------------------------------------
+static void MakeImage(const QTPD_Config *c, QTPD_RegImage *img)
+{
+	int i;
+
+	memset(img, 0, sizeof(QTPD_RegImage));
+	img->Iped = c->Iped;
+	for(i=0; i<QTP_MAX_CH; i++)
+		img->LLD[i] = c->LLD[i]/16;  // threshold step = 16
+	if (!c->EnableSuppression)
+		img->BitSet2 = 0x0010 | 0x0008 | 0x1000;  // disable zero and overrange suppression, enable empty events
+	img->DiscrChMask = c->DiscrChMask;
+	img->DiscrOutputWidth = c->DiscrOutputWidth;
+	memcpy(img->DiscrThreshold, c->DiscrThreshold, sizeof(img->DiscrThreshold));
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: write the registers of the board that differ from its image (all the QTP registers if
+//              All is set; the discriminator is programmed by QTPD_Open) and update the image. The
+//              changed registers are collected and written with one QTPD_WriteRegs for each board.
+// Return:		number of registers written, -1=VME error
+// ---------------------------------------------------------------------------------------------------------
+static int WriteImage(QTPD_Board *b, const QTPD_RegImage *img, int All)
+{
+	QTPD_RegImage *cur = &b->Image;
+	uint16_t addr[QTP_MAX_CH + 3], data[QTP_MAX_CH + 3];
+	uint16_t set, clr;
+	int i, n = 0, nw;
+
+	if (All || (img->Iped != cur->Iped)) {
+		addr[n] = 0x1060;  // Set pedestal
+		data[n++] = img->Iped;
+	}
+	// LLD (low level threshold for ADC data)
+	for(i=0; i<b->NumCh; i++) {
+		if (All || (img->LLD[i] != cur->LLD[i])) {
+			addr[n] = b->NumCh == 16 ? 0x1080 + i*4 : 0x1080 + i*2;
+			data[n++] = img->LLD[i];
+		}
+	}
+	// suppression: the bits are set by Bit Set 2 and cleared by Bit Clear 2
+	set = All ? img->BitSet2 : img->BitSet2 & ~cur->BitSet2;
+	clr = All ? 0 : cur->BitSet2 & ~img->BitSet2;
+	if (set) {
+		addr[n] = 0x1032;
+		data[n++] = set;
+	}
+	if (clr) {
+		addr[n] = 0x1034;
+		data[n++] = clr;
+	}
+	if (n > 0)
+		QTPD_WriteRegs(b, addr, data, n);
+	nw = n;
+
+	if (b->Link.DiscrBaseAddr > 0) {
+		n = 0;
+		if (img->DiscrChMask != cur->DiscrChMask) {
+			addr[n] = 0x004A;
+			data[n++] = img->DiscrChMask;
+		}
+		if (img->DiscrOutputWidth != cur->DiscrOutputWidth) {
+			addr[n] = 0x0040;
+			data[n++] = img->DiscrOutputWidth;
+			addr[n] = 0x0042;
+			data[n++] = img->DiscrOutputWidth;
+		}
+		for(i=0; i<16; i++) {
+			if (img->DiscrThreshold[i] != cur->DiscrThreshold[i]) {
+				addr[n] = i*2;
+				data[n++] = img->DiscrThreshold[i];
+			}
+		}
+		if (n > 0) {
+			b->BaseAddress = b->Link.DiscrBaseAddr;
+			QTPD_WriteRegs(b, addr, data, n);
+			b->BaseAddress = b->Link.QTPBaseAddr;
+		}
+		nw += n;
+	}
+
+	if (b->VMEerror) {
+		printf("Error during QTP programming: ");
+		printf("%s", b->ErrorString);
+		b->VMEerror = 0;
+		return -1;
+	}
+	*cur = *img;
+	return nw;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: program the QTP boards (pedestal, thresholds, suppression)
+// Return:		0=OK, -1=VME error
+// ---------------------------------------------------------------------------------------------------------
+int QTPD_Configure(QTPD *q)
+{
+	QTPD_RegImage img;
+	int k, ret = 0;
+
+	MakeImage(&q->cfg, &img);
+	for(k=0; k<q->NumBoards; k++) {
+		QTPD_Board *b = q->Board[k];
+
+		QTPD_WriteReg(b, 0x1010, 0x60);  // enable BERR to close BLT at and of block
+		QTPD_WriteReg(b, 0x1034, 0x100);  // set threshold step = 16
+		if (WriteImage(b, &img, 1) < 0)
+			ret = -1;
+	}
+	return ret;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: with the fill threads, update histo and ns[] of a board with the sum of the shards and
+//              search the peaks of the statistics in it
+// ---------------------------------------------------------------------------------------------------------
+static void MergeShards(QTPD_Board *b)
+{
+	if (b->HFill.NumWorkers == 0)
+		return;
+	HistFill_Merge(&b->HFill, &b->histo, b->ns);
+	Stats_FindPeaks(&b->ChStats, &b->histo);
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: append to the histogram archives the slices that are complete (Force = close the current
+//              slices anyway, e.g. before clearing the histograms)
+// ---------------------------------------------------------------------------------------------------------
+static void ArchiveSlices(QTPD *q, int Force)
+{
+	uint64_t now = Timer_Now();
+	int k;
+
+	for(k=0; k<q->NumBoards; k++) {
+		QTPD_Board *b = q->Board[k];
+
+		if (!(Force ? b->Arch.Enabled : HistArchive_Due(&b->Arch, now)))
+			continue;
+		pthread_mutex_lock(&b->Lock);
+		MergeShards(b);
+		if (HistArchive_Update(&b->Arch, &b->histo, now, q->Segment) < 0)
+			printf("Can't write the histogram archive\n");
+		pthread_mutex_unlock(&b->Lock);
+	}
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: clear histograms, statistics and rates (the counts since the last slice of the archive
+//              are saved first)
+// ---------------------------------------------------------------------------------------------------------
+static void DoReset(QTPD *q)
+{
+	int k;
+
+	ArchiveSlices(q, 1);
+	RateMeter_Init(&q->Rates, q->cfg.RateWindow, Timer_Now());
+	for(k=0; k<q->NumBoards; k++) {
+		QTPD_Board *b = q->Board[k];
+
+		pthread_mutex_lock(&b->Lock);
+		memset(b->ns, 0, sizeof(b->ns));
+		Histo_Reset(&b->histo);
+		Stats_Reset(&b->ChStats);
+		if (q->cfg.EnableCalib) Calib_Reset(&b->Cal);
+		if (b->HFill.NumWorkers > 0) HistFill_Reset(&b->HFill);
+		Hist2D_Reset(&b->H2);
+		if (b->GatedHisto.NumCh > 0) Histo_Reset(&b->GatedHisto);
+		Filter_Reset(&b->Flt);
+		Suppressor_Reset(&b->Supp);
+		HistArchive_Reset(&b->Arch);
+		pthread_mutex_unlock(&b->Lock);
+	}
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: check the settings that are applied only by QTPD_Open (links, base addresses, buffers,
+//              threads, allocation of the histograms) or read by the front-end at startup (output
+//              files, stream, scan and tuning modes). They are compared one by one: the structure has
+//              padding and fields normalized by QTPD_Open.
+// Return:		1 if some of them differ, 0 otherwise
+// ---------------------------------------------------------------------------------------------------------
+static int NeedsRestart(const QTPD_Config *c, const QTPD_Config *n)
+{
+	int k;
+
+	if (n->NumLinks != c->NumLinks)
+		return 1;
+	for(k=0; k<c->NumLinks; k++) {
+		const QTPD_LinkConfig *lc = &c->Link[k], *ln = &n->Link[k];
+		if ((ln->LinkType != lc->LinkType) || (ln->LinkPid != lc->LinkPid) || (strcmp(ln->LinkIp, lc->LinkIp) != 0) ||
+			(ln->ConetNode != lc->ConetNode) || (ln->QTPBaseAddr != lc->QTPBaseAddr) ||
+			(ln->DiscrBaseAddr != lc->DiscrBaseAddr) || (ln->Core != lc->Core))
+			return 1;
+	}
+	// readout buffers, block transfers and threads
+	if ((n->BltBufferCount != c->BltBufferCount) || (n->BltBufferSize != c->BltBufferSize) ||
+		(n->BltHugePages != c->BltHugePages) || (n->BltLockMemory != c->BltLockMemory) ||
+		(n->BltAdaptive != c->BltAdaptive) || (n->BltMinSize != c->BltMinSize) ||
+		(n->FillThreads != c->FillThreads) || (n->TimerSource != c->TimerSource))
+		return 1;
+	// histograms
+	if ((n->HistoBins != c->HistoBins) || (n->NumHist2D != c->NumHist2D) || (n->Hist2DMaxTiles != c->Hist2DMaxTiles) ||
+		(memcmp(n->Hist2DPairs, c->Hist2DPairs, sizeof(c->Hist2DPairs)) != 0) ||
+		(n->HistoArchiveInterval != c->HistoArchiveInterval) || (n->EnableCalib != c->EnableCalib) ||
+		(n->CalHistoBins != c->CalHistoBins) || (n->CalHistoMin != c->CalHistoMin) || (n->CalHistoMax != c->CalHistoMax))
+		return 1;
+	// output files, stream and startup modes
+	if ((strcmp(n->DataPath, c->DataPath) != 0) || (n->EnableHistoFiles != c->EnableHistoFiles) ||
+		(n->EnableListFile != c->EnableListFile) || (n->EnableRawDataFile != c->EnableRawDataFile) ||
+		(n->EnableStatsFile != c->EnableStatsFile) || (n->EnableTimeStamps != c->EnableTimeStamps) ||
+		(strcmp(n->StreamSocket, c->StreamSocket) != 0) || (n->StreamTcpPort != c->StreamTcpPort) ||
+		(n->StreamRingSize != c->StreamRingSize) || (n->StreamContent != c->StreamContent) ||
+		(n->DiscrScanMode != c->DiscrScanMode) || (n->LldTuneMode != c->LldTuneMode) || (n->BltSweepMode != c->BltSweepMode))
+		return 1;
+	return 0;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: apply new settings between two runs (QTPD_Stop ... QTPD_Start) without reopening the
+//              links: only the registers that changed are written, the software suppression, the
+//              selection, the statistics and the calibration file are updated, histograms and
+//              statistics are cleared and the run segment is incremented. The settings that need
+//              QTPD_Open (see NeedsRestart) are ignored.
+// Return:		number of registers written, -1=error
+// ---------------------------------------------------------------------------------------------------------
+int QTPD_Reconfigure(QTPD *q, const QTPD_Config *cfg)
+{
+	QTPD_Config *c = &q->cfg;
+	QTPD_RegImage img;
+	int k, n, nw = 0, NewCalib;
+
+	if (q->Running || q->LinksRunning) {
+		printf("Can't reconfigure the boards during the run\n");
+		return -1;
+	}
+	if (NeedsRestart(c, cfg))
+		printf("Some of the new settings need a restart of the program and have been ignored\n");
+	c->Iped = cfg->Iped;
+	memcpy(c->LLD, cfg->LLD, sizeof(c->LLD));
+	c->EnableSuppression = cfg->EnableSuppression;
+	c->DiscrChMask = cfg->DiscrChMask;
+	c->DiscrOutputWidth = cfg->DiscrOutputWidth;
+	memcpy(c->DiscrThreshold, cfg->DiscrThreshold, sizeof(c->DiscrThreshold));
+	c->SwSuppression = cfg->SwSuppression;
+	memcpy(c->SwThreshold, cfg->SwThreshold, sizeof(c->SwThreshold));
+	c->SwKeepOverflow = cfg->SwKeepOverflow;
+	c->SwSuppressHistos = cfg->SwSuppressHistos;
+	c->Select = cfg->Select;
+	c->PedWindow = cfg->PedWindow;
+	c->PedTrackDepth = cfg->PedTrackDepth;
+	c->PeakHalfWidth = cfg->PeakHalfWidth;
+	c->RateWindow = cfg->RateWindow;
+	c->BltSweepStepTime = cfg->BltSweepStepTime;
+	c->DiscrScanStart = cfg->DiscrScanStart;
+	c->DiscrScanStop = cfg->DiscrScanStop;
+	c->DiscrScanStep = cfg->DiscrScanStep;
+	c->DiscrScanTime = cfg->DiscrScanTime;
+	c->LldTuneSigmas = cfg->LldTuneSigmas;
+	c->LldTuneTime = cfg->LldTuneTime;
+	NewCalib = c->EnableCalib && (cfg->CalibFileName[0] != 0) && (strcmp(cfg->CalibFileName, c->CalibFileName) != 0);
+	strcpy(c->CalibFileName, cfg->CalibFileName);
+
+	MakeImage(c, &img);
+	for(k=0; k<q->NumBoards; k++) {
+		QTPD_Board *b = q->Board[k];
+		if ((n = WriteImage(b, &img, 0)) < 0)
+			return -1;
+		nw += n;
+		Suppressor_Init(&b->Supp, c->SwSuppression, c->SwThreshold, c->SwKeepOverflow);
+		// selection: the gated histograms are allocated or freed with it
+		Filter_Compile(&b->Flt, &c->Select);
+		if (b->Flt.Enabled && (b->GatedHisto.NumCh == 0) && (Histo_Init(&b->GatedHisto, b->NumCh, b->histo.Bins) < 0)) {
+			printf("Can't allocate the histograms\n");
+			return -1;
+		}
+		if (!b->Flt.Enabled && (b->GatedHisto.NumCh > 0))
+			Histo_Close(&b->GatedHisto);
+		b->ChStats.PedWindow = c->PedWindow > 0 ? c->PedWindow : 1;
+		b->ChStats.PedDepth = c->PedTrackDepth > 0 ? c->PedTrackDepth : 1;
+		b->ChStats.PeakHalfWidth = c->PeakHalfWidth > 0 ? c->PeakHalfWidth : 1;
+		if (NewCalib) {
+			if (Calib_Load(&b->Cal, c->CalibFileName) == 0)
+				printf("Calibration loaded from %s\n", c->CalibFileName);
+			RetireCalib(b);
+		}
+	}
+	DoReset(q);
+	q->Segment++;
+	return nw;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: fill histograms and statistics of the board with the events of a view, apply the
+//              software suppression and the selection. The histograms are filled before the
+//              suppression, unless SwSuppressHistos is set. The fill threads read the decoded
+//              events in place: the suppression after them writes the view's events in SuppBuf.
+// ---------------------------------------------------------------------------------------------------------
+static void ProcessEvents(QTPD_Board *b, QTPD_View *v)
+{
+	QTP_Event *Events = (QTP_Event *)v->ev;
+	int *Sel = (int *)v->sel;
+	int EnableCalib = b->q->cfg.EnableCalib;
+	int SuppressFirst = b->Supp.Enabled && b->q->cfg.SwSuppressHistos;
+	int Workers = b->HFill.NumWorkers;
+	int e, j;
+
+	pthread_mutex_lock(&b->Lock);
+	if (SuppressFirst)
+		v->nev = Decoder_Suppress(&b->Supp, Events, Events, v->nev);
+	if (EnableCalib && (Workers == 0))  // before reading the calibration table
+		__atomic_store_n(&b->CalIn, b->CalIn + 1, __ATOMIC_SEQ_CST);
+
+	// with the fill threads, histo is the merged view updated by QTPD_Refresh (which also
+	// searches the peaks of the statistics in it)
+	if (Workers > 0)
+		HistFill_Submit(&b->HFill, Events, v->nev, v->blk);
+	else
+		Histo_FillEvents(&b->histo, Events, v->nev, b->ns);
+	for(e=0; e<v->nev; e++) {
+		QTP_Event *ev = &Events[e];
+		uint32_t mask = ev->ChMask;
+		while (mask && EnableCalib && (Workers == 0)) {  // filled by the threads
+			j = __builtin_ctz(mask);
+			mask &= mask - 1;
+			if (j < b->Cal.NumCh)
+				Calib_Fill(&b->Cal, j, ev->Data[j]);
+		}
+		Stats_AddEvent(&b->ChStats, ev->Data, Workers > 0 ? NULL : &b->histo);
+	}
+	Hist2D_FillEvents(&b->H2, Events, v->nev);
+	__atomic_store_n(&b->CalOut, b->CalIn, __ATOMIC_RELEASE);
+
+	// the outputs (and the callback) get only the suppressed events
+	if (b->Supp.Enabled && !SuppressFirst) {
+		QTP_Event *out = Workers > 0 ? b->SuppBuf + (Events - b->EvBuf) : Events;
+		v->nev = Decoder_Suppress(&b->Supp, Events, out, v->nev);
+		v->ev = Events = out;
+	}
+
+	// event selection and gated histograms
+	v->nsel = Filter_Batch(&b->Flt, Events, v->nev, Sel);
+	if (b->GatedHisto.NumCh > 0) {
+		for(e=0; e<v->nsel; e++) {
+			QTP_Event *ev = &Events[Sel[e]];
+			uint32_t mask = ev->ChMask;
+			while (mask) {
+				j = __builtin_ctz(mask);
+				mask &= mask - 1;
+				Histo_Fill(&b->GatedHisto, j, ev->Data[j]);
+			}
+		}
+	}
+	pthread_mutex_unlock(&b->Lock);
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: read a block from the board and decode it
+// Return:		view of the block or NULL if there are no data
+// ---------------------------------------------------------------------------------------------------------
+static QTPD_View *ReadBlock(QTPD_Board *b)
+{
+	BufPool_Block *blk;
+	QTPD_View *v;
+	uint32_t *buffer;
+	int bcnt, wcnt, BoardFull = 0;
+
+	blk = BufPool_Get(&b->Pool);
+	if (blk == NULL)  // pool exhausted (all the buffers are still held by the consumers)
+		return NULL;
+	v = &b->Views[blk->index];
+	buffer = blk->data;
+	CAENVME_FIFOMBLTReadCycle(b->handle, b->BaseAddress, (char *)buffer, b->Sizer.CurSize, cvA32_U_MBLT, &bcnt);
+	blk->TimeStamp = Timer_Now() - b->q->RunStart;  // read completion
+	blk->nbytes = bcnt;
+	if (BltSizer_NeedsStatus(&b->Sizer, bcnt))
+		BoardFull = (QTPD_ReadReg(b, 0x1022) >> 2) & 1;  // Status Register 2: buffer full
+	BltSizer_Update(&b->Sizer, bcnt, BoardFull);
+	if (ENABLE_LOG && (b->logfile != NULL) && (bcnt>0)) {
+		int i;
+		fprintf(b->logfile, "Read Data Block: size = %d bytes\n", bcnt);
+		for(i=0; i<(bcnt/4); i++)
+			fprintf(b->logfile, "%2d: %08X\n", i, buffer[i]);
+	}
+	wcnt = bcnt > 0 ? bcnt/4 : 0;  // num of lword read in the MBLT cycle
+
+	// the events of the block arrived between the previous read and this one:
+	// their time stamps are interpolated over that interval
+	v->NevInBlock = CountEvents(buffer, wcnt);
+	Decoder_SetBlockTime(&b->Dec, b->PrevBlockTime, blk->TimeStamp, v->NevInBlock);
+	b->PrevBlockTime = blk->TimeStamp;
+	if (wcnt == 0) {  // no data available
+		BufPool_Release(blk);
+		return NULL;
+	}
+	v->raw = buffer;
+	v->nwords = wcnt;
+	v->TimeStamp = blk->TimeStamp;
+	v->ev = b->EvBuf + (size_t)blk->index * b->MaxEvents;  // ProcessEvents may have moved it to SuppBuf
+
+	// decode the block
+	v->nev = Decoder_DecodeBlock(&b->Dec, buffer, wcnt, (QTP_Event *)v->ev, b->MaxEvents);
+	if (b->Dec.Error) {
+		QTPD_WriteReg(b, 0x1032, 0x4);
+		QTPD_WriteReg(b, 0x1034, 0x4);
+		Decoder_Reset(&b->Dec);
+	}
+	return v;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: readout thread of a link: the decoded blocks are queued for QTPD_Read
+// ---------------------------------------------------------------------------------------------------------
+static void *LinkThread(void *arg)
+{
+	QTPD_Board *b = (QTPD_Board *)arg;
+	QTPD *q = b->q;
+	QTPD_View *v;
+
+	if (b->Link.Core >= 0) {
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(b->Link.Core, &cpus);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0)
+			printf("Can't pin the readout thread of link %d to core %d\n", b->Index, b->Link.Core);
+	}
+	while (q->LinksRunning) {
+		v = ReadBlock(b);
+		if (v == NULL) {
+			usleep(100);
+			continue;
+		}
+		pthread_mutex_lock(&q->QueueLock);
+		q->Queue[(q->QueueHead + q->QueueCount) % q->QueueSize] = v;
+		q->QueueCount++;
+		pthread_cond_signal(&q->QueueCond);
+		pthread_mutex_unlock(&q->QueueLock);
+	}
+	return NULL;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: take the oldest block queued by the link threads, waiting up to WaitMs if there is none
+// Return:		view of the block or NULL
+// ---------------------------------------------------------------------------------------------------------
+static QTPD_View *PopView(QTPD *q, int WaitMs)
+{
+	const QTPD_View *v = NULL;
+
+	pthread_mutex_lock(&q->QueueLock);
+	if ((q->QueueCount == 0) && (WaitMs > 0)) {
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += WaitMs * 1000000L;
+		if (ts.tv_nsec >= 1000000000L) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000L;
+		}
+		pthread_cond_timedwait(&q->QueueCond, &q->QueueLock, &ts);
+	}
+	if (q->QueueCount > 0) {
+		v = q->Queue[q->QueueHead];
+		q->QueueHead = (q->QueueHead + 1) % q->QueueSize;
+		q->QueueCount--;
+	}
+	pthread_mutex_unlock(&q->QueueLock);
+	return (QTPD_View *)v;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: stop the readout threads of the links (the queued blocks are left in the queue)
+// ---------------------------------------------------------------------------------------------------------
+static void StopLinks(QTPD *q)
+{
+	int k;
+
+	if (!q->LinksRunning)
+		return;
+	q->LinksRunning = 0;
+	for(k=0; k<q->NumBoards; k++)
+		pthread_join(q->Board[k]->Thread, NULL);
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: read a block (from the board or, with the link threads, from the queue), decode it
+//              and fill the histograms of its board (pull interface)
+// Return:		view of the block (to be released with QTPD_Release) or NULL if there are no data
+// ---------------------------------------------------------------------------------------------------------
+const QTPD_View *QTPD_Read(QTPD *q)
+{
+	QTPD_View *v;
+
+	if (q->ResetReq) {
+		DoReset(q);
+		q->ResetReq = 0;
+	}
+	ArchiveSlices(q, 0);
+
+	if (q->Threaded)
+		v = PopView(q, QUEUE_WAIT_MS);
+	else
+		v = ReadBlock(q->Board[0]);
+	if (v == NULL)
+		return NULL;
+	RateMeter_Add(&q->Rates, Timer_Now(), v->NevInBlock, v->nwords * 4);
+	ProcessEvents(q->Board[v->Board], v);
+	return v;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: keep a view after the callback has returned / give it back to the library
+// ---------------------------------------------------------------------------------------------------------
+void QTPD_Retain(const QTPD_View *view)
+{
+	BufPool_Retain(view->blk);
+}
+
+void QTPD_Release(const QTPD_View *view)
+{
+	BufPool_Release(view->blk);
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: set the function that receives the views in the readout thread (NULL = pull interface)
+// ---------------------------------------------------------------------------------------------------------
+void QTPD_SetCallback(QTPD *q, QTPD_Callback cb, void *user)
+{
+	q->Callback = cb;
+	q->User = user;
+}
+
+
+static void *ReadoutThread(void *arg)
+{
+	QTPD *q = (QTPD *)arg;
+
+	while (q->Running) {
+		const QTPD_View *v = QTPD_Read(q);
+		if (v == NULL) {
+			usleep(100);
+			continue;
+		}
+		q->Callback(v, q->User);
+		QTPD_Release(v);
+	}
+	return NULL;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: clear the board buffers and start the run (the readout threads of the links and, if a
+//              callback is set, the thread that processes the blocks)
+// Return:		0=OK, -1=error
+// ---------------------------------------------------------------------------------------------------------
+int QTPD_Start(QTPD *q)
+{
+	int k;
+
+	for(k=0; k<q->NumBoards; k++) {
+		QTPD_Board *b = q->Board[k];
+
+		// clear Event Counter
+		QTPD_WriteReg(b, 0x1040, 0x0);
+		// clear QTP
+		QTPD_WriteReg(b, 0x1032, 0x4);
+		QTPD_WriteReg(b, 0x1034, 0x4);
+
+		Decoder_Reset(&b->Dec);
+		b->PrevBlockTime = 0;
+	}
+	q->RunStart = Timer_Now();
+	RateMeter_Init(&q->Rates, q->cfg.RateWindow, q->RunStart);
+	if (q->Threaded) {
+		q->LinksRunning = 1;
+		for(k=0; k<q->NumBoards; k++) {
+			if (pthread_create(&q->Board[k]->Thread, NULL, LinkThread, q->Board[k]) != 0) {
+				printf("Can't start the readout thread of link %d\n", k);
+				q->LinksRunning = 0;
+				while (--k >= 0)
+					pthread_join(q->Board[k]->Thread, NULL);
+				return -1;
+			}
+		}
+	}
+	if (q->Callback != NULL) {
+		q->Running = 1;
+		if (pthread_create(&q->Thread, NULL, ReadoutThread, q) != 0) {
+			q->Running = 0;
+			StopLinks(q);
+			printf("Can't start the readout thread\n");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: stop the readout threads and wait for the histograms to be filled. The blocks still
+//              queued by the link threads are passed to the callback, if set; with the pull interface
+//              they are discarded, like the data left in the boards.
+// ---------------------------------------------------------------------------------------------------------
+void QTPD_Stop(QTPD *q)
+{
+	QTPD_View *v;
+	int k;
+
+	StopLinks(q);
+	if (q->Running) {
+		q->Running = 0;
+		pthread_join(q->Thread, NULL);
+	}
+	while (q->Threaded && ((v = PopView(q, 0)) != NULL)) {
+		if (q->Callback != NULL) {
+			RateMeter_Add(&q->Rates, Timer_Now(), v->NevInBlock, v->nwords * 4);
+			ProcessEvents(q->Board[v->Board], v);
+			q->Callback(v, q->User);
+		}
+		QTPD_Release(v);
+	}
+	for(k=0; k<q->NumBoards; k++) {
+		if (q->Board[k]->HFill.NumWorkers > 0)
+			HistFill_Flush(&q->Board[k]->HFill);
+	}
+	QTPD_Refresh(q);
+	ArchiveSlices(q, 1);
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: time from the start of the run (ns)
+// ---------------------------------------------------------------------------------------------------------
+uint64_t QTPD_RunTime(QTPD *q)
+{
+	return Timer_Now() - q->RunStart;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: clear histograms, statistics and rates. With the readout thread running, the reset
+//              is done by the thread before the next block.
+// ---------------------------------------------------------------------------------------------------------
+void QTPD_Reset(QTPD *q)
+{
+	if (q->Running)
+		q->ResetReq = 1;
+	else
+		DoReset(q);
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: update histo and ns[] of the boards (sum of the shards of the fill threads) and
+//              reload the calibration if the file has been modified
+// ---------------------------------------------------------------------------------------------------------
+void QTPD_Refresh(QTPD *q)
+{
+	int k;
+
+	for(k=0; k<q->NumBoards; k++) {
+		QTPD_Board *b = q->Board[k];
+		pthread_mutex_lock(&b->Lock);
+		MergeShards(b);
+		if (q->cfg.EnableCalib) {
+			Calib_CheckReload(&b->Cal);
+			RetireCalib(b);
+		}
+		pthread_mutex_unlock(&b->Lock);
+	}
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: reload the calibration file (of all the boards)
+// Return:		0=OK, -1=error
+// ---------------------------------------------------------------------------------------------------------
+int QTPD_ReloadCalib(QTPD *q)
+{
+	int k, ret = 0;
+
+	if (!q->cfg.EnableCalib)
+		return -1;
+	for(k=0; k<q->NumBoards; k++) {
+		QTPD_Board *b = q->Board[k];
+		pthread_mutex_lock(&b->Lock);
+		if ((b->Cal.FileName[0] == 0) || (Calib_Load(&b->Cal, b->Cal.FileName) < 0))
+			ret = -1;
+		RetireCalib(b);
+		pthread_mutex_unlock(&b->Lock);
+	}
+	return ret;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: save all the histograms (1D, gated, calibrated and 2D) of each board in DataPath
+//              (the file names of the boards after the first one are prefixed by "B<index>_")
+// Return:		0=OK, -1=error
+// ---------------------------------------------------------------------------------------------------------
+int QTPD_SaveHistograms(QTPD *q)
+{
+	int k, ret = 0;
+
+	for(k=0; k<q->NumBoards; k++) {
+		QTPD_Board *b = q->Board[k];
+
+		pthread_mutex_lock(&b->Lock);
+		MergeShards(b);
+		ret |= SaveHistograms(&b->histo, b->Prefix, "Histo");
+		if (b->GatedHisto.NumCh > 0)
+			ret |= SaveHistograms(&b->GatedHisto, b->Prefix, "GatedHisto");
+		if (q->cfg.EnableCalib)
+			ret |= Calib_Save(&b->Cal, b->Prefix);
+		ret |= Hist2D_Save(&b->H2, b->Prefix);
+		pthread_mutex_unlock(&b->Lock);
+	}
+	return ret < 0 ? -1 : 0;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: print selection, buffer pool and block transfer statistics of each board
+// ---------------------------------------------------------------------------------------------------------
+void QTPD_PrintStats(QTPD *q, FILE *f)
+{
+	int k;
+
+	for(k=0; k<q->NumBoards; k++) {
+		QTPD_Board *b = q->Board[k];
+
+		if (q->NumBoards > 1)
+			fprintf(f, "Link %d (V%d%s, %d ch):\n", k, b->Model, b->ModelVersion, b->NumCh);
+		pthread_mutex_lock(&b->Lock);
+		Filter_PrintStats(&b->Flt, f);
+		Suppressor_PrintStats(&b->Supp, f);
+		HistArchive_PrintStats(&b->Arch, f);
+		pthread_mutex_unlock(&b->Lock);
+		BufPool_PrintStats(&b->Pool, f);
+		fprintf(f, "BLT request size = %d bytes (%s), average block = %.0f bytes\n", b->Sizer.CurSize,
+			b->Sizer.Adaptive ? "adaptive" : "fixed", b->Sizer.AvgBytes);
+	}
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: board of a channel, numbering the channels of all the boards in sequence
+// Return:		board (and channel of the board in ch) or NULL if GlobalCh is out of range
+// ---------------------------------------------------------------------------------------------------------
+QTPD_Board *QTPD_FindChannel(QTPD *q, int GlobalCh, int *ch)
+{
+	int k;
+
+	for(k=0; (k<q->NumBoards) && (GlobalCh >= 0); k++) {
+		if (GlobalCh < q->Board[k]->NumCh) {
+			*ch = GlobalCh;
+			return q->Board[k];
+		}
+		GlobalCh -= q->Board[k]->NumCh;
+	}
+	return NULL;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: access to the histograms and statistics of a board from another thread than the
+//              readout thread of the callback (it waits for the end of the block being processed)
+// ---------------------------------------------------------------------------------------------------------
+void QTPD_LockBoard(QTPD_Board *b)
+{
+	pthread_mutex_lock(&b->Lock);
+}
+
+
+void QTPD_UnlockBoard(QTPD_Board *b)
+{
+	pthread_mutex_unlock(&b->Lock);
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: measure the throughput of the first link vs the transfer size (see BltSweep). The
+//              readout threads of the links are stopped.
+// ---------------------------------------------------------------------------------------------------------
+int QTPD_BltSweep(QTPD *q, FILE *fout, int (*StopReq)(void))
+{
+	QTPD_Board *b = q->Board[0];
+
+	StopLinks(q);
+	return BltSweep(b->handle, b->BaseAddress, &b->Pool, q->cfg.BltMinSize, q->cfg.BltSweepStepTime, fout, StopReq);
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: close the link of a board and free its resources
+// ---------------------------------------------------------------------------------------------------------
+static void CloseBoard(QTPD_Board *b)
+{
+	int i;
+
+	HistFill_Close(&b->HFill);
+	HistArchive_Close(&b->Arch);
+	if (b->handle >= 0) CAENVME_End(b->handle);
+	if (b->logfile != NULL) fclose(b->logfile);
+	if (b->StatsFile != NULL) fclose(b->StatsFile);
+	if (b->Views != NULL) {
+		for(i=0; i<b->Pool.NumBlocks; i++)
+			if (b->Views[i].sel != NULL) free((void *)b->Views[i].sel);
+		free(b->Views);
+	}
+	if (b->EvBuf != NULL) free(b->EvBuf);
+	if (b->SuppBuf != NULL) free(b->SuppBuf);
+	BufPool_Close(&b->Pool);
+	Calib_Close(&b->Cal);
+	Hist2D_Close(&b->H2);
+	Histo_Close(&b->histo);
+	Histo_Close(&b->GatedHisto);
+	pthread_mutex_destroy(&b->Lock);
+	free(b);
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: stop the run, close the links and free all the resources
+// ---------------------------------------------------------------------------------------------------------
+void QTPD_Close(QTPD *q)
+{
+	int k;
+
+	StopLinks(q);
+	if (q->Running) {
+		q->Running = 0;
+		pthread_join(q->Thread, NULL);
+	}
+	for(k=0; k<q->NumBoards; k++)
+		CloseBoard(q->Board[k]);
+	if (q->Queue != NULL) free((void *)q->Queue);
+	pthread_mutex_destroy(&q->QueueLock);
+	pthread_cond_destroy(&q->QueueCond);
+	memset(q, 0, sizeof(QTPD));
+}
@@ -0,0 +1,168 @@
+/******************************************************************************
+*
+* CAEN SpA - Front End Division
+* Via Vetraia, 11 - 55049 - Viareggio ITALY
+* +390594388398 - www.caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This program is free software; you can redistribute it and/or modify it under
+* the terms of the GNU General Public License as published by the Free Software
+* Foundation. This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+/*******************************************************************************
+Extraction of the time-sliced histogram archive written by QTPD_DAQ
+(HISTO_ARCHIVE_INTERVAL in the config file). The times are in seconds from the
+start of the archive.
+
+QTPD_Archive <archive> list
+	one line per slice: number, segment, start, end, wall clock time, counts
+QTPD_Archive <archive> sum <t0> <t1> [output prefix]
+	sum of the slices between t0 and t1, saved as histogram files
+	(<prefix>V792nQDC_Histo_<ch>.txt, default prefix ./)
+QTPD_Archive <archive> drift <ch> [window] [min bin]
+	counts, mean, rms and peak of the channel (bins >= min bin) in windows of
+	the given seconds (default one slice): gain and pedestal drift
+
+<archive> is the archive file (e.g. data/V792nQDC_HistoArchive.dat).
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "HistArchive.h"
+
+static uint32_t histo[HARCH_MAX_CH][HARCH_BINS];
+
+
+static void PrintSlice(const HArch_Index *ix)
+{
+	char wt[32];
+	time_t t = (time_t)ix->WallTime;
+
+	strftime(wt, sizeof(wt), "%Y-%m-%dT%H:%M:%S", localtime(&t));
+	printf("%6u %4u %12.3f %12.3f %s %12llu\n", ix->Slice, ix->Segment, ix->TStart * 1e-9, ix->TEnd * 1e-9, wt,
+		(unsigned long long)ix->Counts);
+}
+
+
+static int List(HArchReader *rd)
+{
+	HArch_Index ix;
+	uint32_t s;
+
+	printf("# interval %u ms, %d channels, %u bins, %u slices\n", rd->Hdr.Interval, rd->Hdr.NumCh, rd->Hdr.Bins, rd->NumSlices);
+	printf("# slice segment t_start t_end wall_time counts\n");
+	for(s=0; s<rd->NumSlices; s++) {
+		if (HArchReader_GetIndex(rd, s, &ix) < 0)
+			return -1;
+		PrintSlice(&ix);
+	}
+	return 0;
+}
+
+
+static int Sum(HArchReader *rd, double t0, double t1, const char *prefix)
+{
+	HArch_Index range;
+	int ch, i, n;
+
+	n = HArchReader_Sum(rd, (uint64_t)(t0 * 1e9), (uint64_t)(t1 * 1e9), histo, &range);
+	if (n < 0)
+		return -1;
+	printf("%d slices, %.3f - %.3f s, %llu counts\n", n, range.TStart * 1e-9, range.TEnd * 1e-9,
+		(unsigned long long)range.Counts);
+	for(ch=0; ch<rd->Hdr.NumCh; ch++) {
+		FILE *fout;
+		char fname[300];
+		sprintf(fname, "%sV792nQDC_Histo_%d.txt", prefix, ch);
+		if ((fout = fopen(fname, "w")) == NULL) {
+			printf("Can't open %s\n", fname);
+			return -1;
+		}
+		for(i=0; i<(int)rd->Hdr.Bins; i++)
+			fprintf(fout, "%u\n", histo[ch][i]);
+		fclose(fout);
+	}
+	return 0;
+}
+
+
+static int Drift(HArchReader *rd, int ch, double window, int MinBin)
+{
+	HArch_Index ix, range;
+	uint64_t t, tend;
+
+	if ((ch < 0) || (ch >= rd->Hdr.NumCh) || (HArchReader_GetIndex(rd, rd->NumSlices - 1, &ix) < 0))
+		return -1;
+	tend = ix.TEnd;
+	if (window <= 0)
+		window = rd->Hdr.Interval * 1e-3;
+	printf("# ch %d, bins >= %d, windows of %.3f s\n", ch, MinBin, window);
+	printf("# t_start t_end counts mean rms peak\n");
+	for(t=0; t<tend; t+=(uint64_t)(window * 1e9)) {
+		double n = 0, s = 0, s2 = 0;
+		uint32_t max = 0;
+		int i, peak = -1;
+		if (HArchReader_Sum(rd, t, t + (uint64_t)(window * 1e9), histo, &range) <= 0)
+			continue;
+		for(i=MinBin; i<(int)rd->Hdr.Bins; i++) {
+			n += histo[ch][i];
+			s += (double)histo[ch][i] * i;
+			s2 += (double)histo[ch][i] * i * i;
+			if (histo[ch][i] > max) {
+				max = histo[ch][i];
+				peak = i;
+			}
+		}
+		if (n > 0) {
+			s /= n;
+			s2 = sqrt(s2 / n - s * s > 0 ? s2 / n - s * s : 0);
+		}
+		printf("%12.3f %12.3f %10.0f %9.2f %8.2f %5d\n", range.TStart * 1e-9, range.TEnd * 1e-9, n, s, s2, peak);
+		// windows shorter than a slice: skip to the next slice
+		if (range.TEnd > t + (uint64_t)(window * 1e9))
+			t = range.TEnd - (uint64_t)(window * 1e9);
+	}
+	return 0;
+}
+
+
+/******************************************************************************/
+/*                                   MAIN                                     */
+/******************************************************************************/
+int main(int argc, char *argv[])
+{
+	HArchReader rd;
+	int ret = -1;
+
+	if (argc < 3) {
+		printf("Usage: QTPD_Archive <archive> list\n");
+		printf("       QTPD_Archive <archive> sum <t0> <t1> [output prefix]\n");
+		printf("       QTPD_Archive <archive> drift <ch> [window] [min bin]\n");
+		return 1;
+	}
+	if (HArchReader_Open(&rd, argv[1]) < 0) {
+		printf("Can't open the archive %s\n", argv[1]);
+		return 1;
+	}
+	if (strcmp(argv[2], "list") == 0)
+		ret = List(&rd);
+	else if ((strcmp(argv[2], "sum") == 0) && (argc >= 5))
+		ret = Sum(&rd, atof(argv[3]), atof(argv[4]), argc > 5 ? argv[5] : "./");
+	else if ((strcmp(argv[2], "drift") == 0) && (argc >= 4))
+		ret = Drift(&rd, atoi(argv[3]), argc > 4 ? atof(argv[4]) : 0, argc > 5 ? atoi(argv[5]) : 0);
+	else
+		printf("Unknown command %s\n", argv[2]);
+	if (ret < 0)
+		printf("Error reading the archive\n");
+	HArchReader_Close(&rd);
+	return ret < 0 ? 1 : 0;
+}
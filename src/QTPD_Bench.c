@@ -0,0 +1,530 @@
+/******************************************************************************
+*
+* CAEN SpA - Front End Division
+* Via Vetraia, 11 - 55049 - Viareggio ITALY
+* +390594388398 - www.caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This program is free software; you can redistribute it and/or modify it under
+* the terms of the GNU General Public License as published by the Free Software
+* Foundation. This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+/*******************************************************************************
+Microbenchmarks of the data paths of QTPD_DAQ (make bench): decoding, software
+suppression, histogram fill (in the acquisition thread and with 1, 2 and 4 fill
+threads, FILL_THREADS), histogram reset, list file formatting, raw data writing
+and histogram saving, each one measured on its own.
+The inputs are synthetic data streams of V792N (16 ch), V792 (32 ch, QDC) and
+V775 (32 ch, TDC) boards at several channel occupancies, generated with fixed
+seeds so that the runs are reproducible, plus the raw data file given on the
+command line (src/data/V792nQDC_RawData.txt).
+
+The results go to stdout, one line per benchmark and input (best of the
+repetitions), in the same column format of the other text files of the DAQ:
+# bench input nch occupancy items unit bytes time_ns ns_per_item items_per_s MB_per_s
+unit is "event" (one event of the input) or "histo" (one histogram file);
+reset_wide is the reset of histograms with the 32 bit high words in use (a
+long run), including the clear of the high words at their next overflow;
+fill_t<n> is the time from the first batch queued to n fill threads to the
+end of the fill of the last one;
+bytes are the raw data of the input for decode, suppress and fill, the
+memory cleared for reset and reset_wide and the bytes written for list
+(with Decoder_PrintEvent, as the list file of the DAQ), raw and save
+(MB = 10^6 bytes). The histograms have the bins given with -b (as
+HISTO_NUM_BINS in the config file).
+
+Usage: QTPD_Bench [-n events] [-r repetitions] [-b bins] [raw data file]
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+
+#include "Timer.h"
+#include "Decoder.h"
+#include "Histo.h"
+#include "HistFill.h"
+#include "BufferPool.h"
+
+#define BENCH_EVENTS		200000		// events of each synthetic stream
+#define BENCH_REPS			5
+#define BENCH_BLOCK_WORDS	16384		// words of each readout block (64 KB)
+#define BENCH_SW_THRESHOLD	150			// threshold of the software suppression
+#define BENCH_FILL_BATCH	1000		// events queued to the fill threads at a time (about one block)
+#define BENCH_MAX_THREADS	4
+
+//****************************************************************************
+// Input data stream (as read from the board)
+//****************************************************************************
+typedef struct {
+	char Name[32];
+	int NumCh;
+	int Occupancy;					// % of the channels present in each event (-1 = file)
+	uint32_t *words;
+	int nw;
+	QTP_Event *ev;					// decoded events (input of the other benchmarks)
+	int nev;
+} BenchInput;
+
+static int NumReps = BENCH_REPS;
+static int NumBins = HISTO_MAX_BINS;
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: random numbers (LCG with a fixed seed, the same on every platform)
+// ---------------------------------------------------------------------------------------------------------
+static uint32_t Rnd(uint32_t *seed)
+{
+	*seed = *seed * 1664525u + 1013904223u;
+	return *seed >> 8;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: write a synthetic data stream in the board data format. QDC values: pedestal with
+//              some signal; TDC values: flat over the range. Values above 3840 have the overflow bit.
+// Return:		0=OK, -1=can't allocate the buffer
+// ---------------------------------------------------------------------------------------------------------
+static int MakeStream(BenchInput *in, const char *model, int NumCh, int Occupancy, int Tdc, int nev)
+{
+	uint32_t seed = 12345 + NumCh * 1000 + Occupancy * 10 + Tdc;
+	uint32_t geo = 0x1Fu << 27;
+	uint32_t *w;
+	int e, j, n = 0;
+
+	sprintf(in->Name, "%s", model);
+	in->NumCh = NumCh;
+	in->Occupancy = Occupancy;
+	if ((w = (uint32_t *)malloc((size_t)nev * (NumCh + 2) * sizeof(uint32_t))) == NULL)
+		return -1;
+	for(e=0; e<nev; e++) {
+		uint32_t *hdr = &w[n++];
+		int nch = 0;
+
+		for(j=0; j<NumCh; j++) {
+			uint32_t val;
+			if ((int)(Rnd(&seed) % 100) >= Occupancy)
+				continue;
+			if (Tdc)
+				val = 200 + Rnd(&seed) % 3800;
+			else if ((Rnd(&seed) % 100) < 20)
+				val = 200 + Rnd(&seed) % 3896;
+			else
+				val = 80 + Rnd(&seed) % 40;
+			w[n++] = geo | DATATYPE_CHDATA | (j << (NumCh == 32 ? 16 : 17)) | QTP_V_BIT |
+				(val >= 3840 ? QTP_OV_BIT : 0) | val;
+			nch++;
+		}
+		*hdr = geo | DATATYPE_HEADER | (nch << 8);
+		w[n++] = geo | DATATYPE_EOB | (e & 0xFFFFFF);
+	}
+	in->words = w;
+	in->nw = n;
+	return 0;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: read a raw data file of the DAQ (the filler words at the end of the blocks are removed)
+// Return:		0=OK, -1=can't read the file
+// ---------------------------------------------------------------------------------------------------------
+static int LoadStream(BenchInput *in, const char *FileName, int NumCh)
+{
+	FILE *f;
+	long size;
+	int i, n = 0;
+
+	if ((f = fopen(FileName, "rb")) == NULL)
+		return -1;
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	if ((size < 4) || ((in->words = (uint32_t *)malloc(size)) == NULL)) {
+		fclose(f);
+		return -1;
+	}
+	size = (long)fread(in->words, sizeof(uint32_t), size / 4, f);
+	fclose(f);
+	for(i=0; i<size; i++) {
+		if ((in->words[i] & DATATYPE_MASK) != DATATYPE_FILLER)
+			in->words[n++] = in->words[i];
+	}
+	sprintf(in->Name, "file");
+	in->NumCh = NumCh;
+	in->Occupancy = -1;
+	in->nw = n;
+	return 0;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: print a result line
+// ---------------------------------------------------------------------------------------------------------
+static void Report(const char *bench, BenchInput *in, uint64_t items, const char *unit, uint64_t bytes, uint64_t ns)
+{
+	if (ns == 0)
+		ns = 1;
+	printf("%s %s %d %d %llu %s %llu %llu %.2f %.0f %.2f\n", bench, in->Name, in->NumCh, in->Occupancy,
+		(unsigned long long)items, unit, (unsigned long long)bytes, (unsigned long long)ns, (double)ns / items,
+		items * 1e9 / ns, bytes * 1e3 / ns);
+	fflush(stdout);
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: decode the input in blocks of BENCH_BLOCK_WORDS (the events are kept in in->ev)
+// ---------------------------------------------------------------------------------------------------------
+static uint64_t BenchDecode(BenchInput *in)
+{
+	Decoder dec;
+	uint64_t t0;
+	int pnt, nev = 0;
+
+	Decoder_Init(&dec, in->NumCh);
+	t0 = Timer_Now();
+	for(pnt=0; pnt<in->nw; pnt+=BENCH_BLOCK_WORDS) {
+		int nw = (in->nw - pnt) < BENCH_BLOCK_WORDS ? in->nw - pnt : BENCH_BLOCK_WORDS;
+		Decoder_SetBlockTime(&dec, pnt, pnt + nw, nw / 2);
+		nev += Decoder_DecodeBlock(&dec, in->words + pnt, nw, in->ev + nev, BENCH_BLOCK_WORDS / 2 + 1);
+	}
+	in->nev = nev;
+	return Timer_Now() - t0;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: software suppression of the decoded events (into a copy)
+// ---------------------------------------------------------------------------------------------------------
+static uint64_t BenchSuppress(BenchInput *in, QTP_Event *work)
+{
+	Suppressor sup;
+	uint16_t thr[QTP_MAX_CH];
+	uint64_t t0;
+	int i;
+
+	for(i=0; i<QTP_MAX_CH; i++)
+		thr[i] = BENCH_SW_THRESHOLD;
+	Suppressor_Init(&sup, 1, thr, 0);
+	t0 = Timer_Now();
+	Decoder_Suppress(&sup, in->ev, work, in->nev);
+	return Timer_Now() - t0;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: fill the histograms like the readout (one bin for each channel of each event)
+// ---------------------------------------------------------------------------------------------------------
+static uint64_t BenchFill(BenchInput *in, HistoSet *histo, int *ns)
+{
+	uint64_t t0;
+
+	Histo_Reset(histo);
+	t0 = Timer_Now();
+	Histo_FillEvents(histo, in->ev, in->nev, ns);
+	return Timer_Now() - t0;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: fill the histograms with NumThreads fill threads, like the readout with FILL_THREADS:
+//              the batches are queued without copies, each one holding a block of a pool (the
+//              merged histograms are compared with the ones of BenchFill)
+// ---------------------------------------------------------------------------------------------------------
+static uint64_t BenchFillThreads(BenchInput *in, int NumThreads, HistoSet *ref)
+{
+	HistFill hf;
+	BufPool pool;
+	HistoSet histo;
+	int ns[QTP_MAX_CH];
+	uint64_t t0, t;
+	int e, n, ch, i;
+
+	if (HistFill_Init(&hf, NumThreads, in->NumCh, NumBins, NULL) < 0)
+		return 0;
+	if (BufPool_Init(&pool, NumThreads * HF_RING_SIZE + 1, 0, 0, 0) < 0) {
+		HistFill_Close(&hf);
+		return 0;
+	}
+	t0 = Timer_Now();
+	for(e=0; e<in->nev; e+=n) {
+		BufPool_Block *blk;
+		n = (in->nev - e) < BENCH_FILL_BATCH ? in->nev - e : BENCH_FILL_BATCH;
+		while ((blk = BufPool_Get(&pool)) == NULL)
+			sched_yield();
+		HistFill_Submit(&hf, in->ev + e, n, blk);
+		BufPool_Release(blk);
+	}
+	HistFill_Flush(&hf);
+	t = Timer_Now() - t0;
+
+	if (Histo_Init(&histo, in->NumCh, NumBins) == 0) {
+		HistFill_Merge(&hf, &histo, ns);
+		for(ch=0; ch<in->NumCh; ch++)
+			for(i=0; i<histo.Bins; i++)
+				if (Histo_GetBin(&histo, ch, i) != Histo_GetBin(ref, ch, i)) {
+					printf("# fill_t%d %s: ch %d bin %d differs from the fill\n", NumThreads, in->Name, ch, i);
+					ch = in->NumCh;
+					break;
+				}
+		Histo_Close(&histo);
+	}
+	HistFill_Close(&hf);
+	BufPool_Close(&pool);
+	return t;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: clear the histograms (a copy of the filled ones; Wide = with 65537 times the counts, so
+//              that the high words are in use). The high words are cleared at the next overflow of
+//              each channel, which is included in the time.
+// ---------------------------------------------------------------------------------------------------------
+static uint64_t BenchReset(HistoSet *histo, HistoSet *work, int Wide, uint64_t *bytes)
+{
+	uint64_t t0, t;
+	uint32_t WideMask;
+	int ch;
+
+	*bytes = 0;
+	for(ch=0; ch<histo->NumCh; ch++) {
+		uint32_t row[HISTO_MAX_BINS];
+		uint64_t row64[HISTO_MAX_BINS];
+		int i;
+		Histo_Snapshot(histo, ch, row);
+		for(i=0; i<histo->Bins; i++)
+			row64[i] = Wide ? row[i] * 65537ULL : row[i];
+		Histo_AddRow(work, ch, row64);
+		*bytes += (uint64_t)work->Bins * sizeof(uint16_t);
+		if (work->WideMask & (1u << ch))
+			*bytes += (uint64_t)work->Bins * sizeof(uint32_t);
+	}
+	WideMask = work->WideMask;
+	t0 = Timer_Now();
+	Histo_Reset(work);
+	for(ch=0; ch<work->NumCh; ch++)
+		if (WideMask & (1u << ch))
+			Histo_Carry(work, ch, 0);
+	t = Timer_Now() - t0;
+	Histo_Reset(work);
+	return t;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: write the list file (same format of the DAQ, with time stamps) to /dev/null
+// ---------------------------------------------------------------------------------------------------------
+static uint64_t BenchList(BenchInput *in, uint64_t *bytes)
+{
+	static char buf[1 << 20];
+	FILE *f;
+	uint64_t t0, t, nb = 0;
+	int e;
+
+	if ((f = fopen("/dev/null", "w")) == NULL)
+		return 0;
+	setvbuf(f, buf, _IOFBF, sizeof(buf));
+	t0 = Timer_Now();
+	for(e=0; e<in->nev; e++)
+		nb += Decoder_PrintEvent(f, &in->ev[e], -1, 1);
+	fflush(f);
+	t = Timer_Now() - t0;
+	fclose(f);
+	*bytes = nb;
+	return t;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: write the readout blocks to a raw data file (temporary file)
+// ---------------------------------------------------------------------------------------------------------
+static uint64_t BenchRaw(BenchInput *in, FILE *f)
+{
+	uint64_t t0;
+	int pnt;
+
+	rewind(f);
+	t0 = Timer_Now();
+	for(pnt=0; pnt<in->nw; pnt+=BENCH_BLOCK_WORDS) {
+		int nw = (in->nw - pnt) < BENCH_BLOCK_WORDS ? in->nw - pnt : BENCH_BLOCK_WORDS;
+		fwrite(in->words + pnt, sizeof(uint32_t), nw, f);
+	}
+	fflush(f);
+	return Timer_Now() - t0;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: save the histograms (one text file for each channel, like QTPD_SaveHistograms)
+// ---------------------------------------------------------------------------------------------------------
+static uint64_t BenchSave(BenchInput *in, HistoSet *histo, const char *dir, uint64_t *bytes)
+{
+	uint64_t t0, t, nb = 0;
+	int j;
+
+	t0 = Timer_Now();
+	for(j=0; j<in->NumCh; j++) {
+		char fname[300];
+		sprintf(fname, "%s/V792nQDC_Histo_%d.txt", dir, j);
+		if (Histo_Save(histo, j, fname) < 0)
+			return 0;
+	}
+	t = Timer_Now() - t0;
+	for(j=0; j<in->NumCh; j++) {
+		FILE *f;
+		char fname[300];
+		sprintf(fname, "%s/V792nQDC_Histo_%d.txt", dir, j);
+		if ((f = fopen(fname, "r")) != NULL) {
+			fseek(f, 0, SEEK_END);
+			nb += ftell(f);
+			fclose(f);
+		}
+	}
+	*bytes = nb;
+	return t;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: run all the benchmarks on an input (best time of NumReps repetitions)
+// ---------------------------------------------------------------------------------------------------------
+static int RunInput(BenchInput *in, const char *dir)
+{
+	HistoSet histo, hwork;
+	int ns[QTP_MAX_CH];
+	QTP_Event *work;
+	FILE *fraw;
+	uint64_t best[8], bestT[BENCH_MAX_THREADS+1], t, lbytes = 0, sbytes = 0, rbytes = 0, wbytes = 0, b = 0;
+	int r, i, j;
+
+	memset(&histo, 0, sizeof(histo));
+	memset(&hwork, 0, sizeof(hwork));
+	in->ev = (QTP_Event *)malloc(((size_t)in->nw / 2 + BENCH_BLOCK_WORDS) * sizeof(QTP_Event));
+	work = (QTP_Event *)malloc(((size_t)in->nw / 2 + BENCH_BLOCK_WORDS) * sizeof(QTP_Event));
+	fraw = tmpfile();
+	if ((in->ev == NULL) || (work == NULL) || (fraw == NULL) || (Histo_Init(&histo, in->NumCh, NumBins) < 0) ||
+		(Histo_Init(&hwork, in->NumCh, NumBins) < 0)) {
+		printf("# %s: can't allocate the buffers\n", in->Name);
+		Histo_Close(&histo);
+		Histo_Close(&hwork);
+		if (fraw != NULL) fclose(fraw);
+		if (work != NULL) free(work);
+		if (in->ev != NULL) free(in->ev);
+		in->ev = NULL;
+		return -1;
+	}
+	for(i=0; i<8; i++)
+		best[i] = (uint64_t)-1;
+	for(i=0; i<=BENCH_MAX_THREADS; i++)
+		bestT[i] = (uint64_t)-1;
+	for(r=0; r<NumReps; r++) {
+		memset(ns, 0, sizeof(ns));
+		if ((t = BenchDecode(in)) < best[0]) best[0] = t;
+		if ((t = BenchSuppress(in, work)) < best[1]) best[1] = t;
+		if ((t = BenchFill(in, &histo, ns)) < best[2]) best[2] = t;
+		for(i=1; i<=BENCH_MAX_THREADS; i<<=1)
+			if ((t = BenchFillThreads(in, i, &histo)) < bestT[i]) bestT[i] = t;
+		if ((t = BenchReset(&histo, &hwork, 0, &b)) < best[6]) best[6] = t;
+		rbytes = b;
+		if ((t = BenchReset(&histo, &hwork, 1, &b)) < best[7]) best[7] = t;
+		wbytes = b;
+		if ((t = BenchList(in, &b)) < best[3]) best[3] = t;
+		lbytes = b;
+		if ((t = BenchRaw(in, fraw)) < best[4]) best[4] = t;
+		if ((t = BenchSave(in, &histo, dir, &b)) < best[5]) best[5] = t;
+		sbytes = b;
+	}
+	for(j=0; j<in->NumCh; j++) {
+		char fname[300];
+		sprintf(fname, "%s/V792nQDC_Histo_%d.txt", dir, j);
+		remove(fname);
+	}
+	Report("decode", in, in->nev, "event", in->nw * 4ULL, best[0]);
+	Report("suppress", in, in->nev, "event", in->nw * 4ULL, best[1]);
+	Report("fill", in, in->nev, "event", in->nw * 4ULL, best[2]);
+	for(i=1; i<=BENCH_MAX_THREADS; i<<=1) {
+		char name[16];
+		sprintf(name, "fill_t%d", i);
+		Report(name, in, in->nev, "event", in->nw * 4ULL, bestT[i]);
+	}
+	Report("reset", in, in->NumCh, "histo", rbytes, best[6]);
+	Report("reset_wide", in, in->NumCh, "histo", wbytes, best[7]);
+	Report("list", in, in->nev, "event", lbytes, best[3]);
+	Report("raw", in, in->nev, "event", in->nw * 4ULL, best[4]);
+	Report("save", in, in->NumCh, "histo", sbytes, best[5]);
+	Histo_Close(&histo);
+	Histo_Close(&hwork);
+	fclose(fraw);
+	free(work);
+	free(in->ev);
+	return 0;
+}
+
+
+/******************************************************************************/
+/*                                   MAIN                                     */
+/******************************************************************************/
+int main(int argc, char *argv[])
+{
+	static const struct { const char *model; int NumCh; int Tdc; } Models[] = {
+		{"V792N", 16, 0}, {"V792", 32, 0}, {"V775", 32, 1}
+	};
+	static const int Occupancy[] = {100, 50, 25, 6};
+	const char *RawFile = NULL;
+	char dir[] = "/tmp/QTPD_BenchXXXXXX";
+	int nev = BENCH_EVENTS;
+	int i, m, o;
+	BenchInput in;
+
+	for(i=1; i<argc; i++) {
+		if ((strcmp(argv[i], "-n") == 0) && (i+1 < argc))
+			nev = atoi(argv[++i]);
+		else if ((strcmp(argv[i], "-r") == 0) && (i+1 < argc))
+			NumReps = atoi(argv[++i]);
+		else if ((strcmp(argv[i], "-b") == 0) && (i+1 < argc))
+			NumBins = atoi(argv[++i]);
+		else
+			RawFile = argv[i];
+	}
+	if (nev < 1) nev = 1;
+	if (NumReps < 1) NumReps = 1;
+	for(i=HISTO_MAX_BINS; (i > NumBins) && (i > 16); i >>= 1);
+	NumBins = i;
+	if (mkdtemp(dir) == NULL) {
+		printf("Can't create the directory for the histogram files\n");
+		return 1;
+	}
+	Timer_Init(TIMER_SOURCE_MONOTONIC);
+
+	printf("# QTPD_Bench: %d events per synthetic stream, best of %d repetitions, blocks of %d bytes, %d bins\n",
+		nev, NumReps, BENCH_BLOCK_WORDS * 4, NumBins);
+	printf("# bench input nch occupancy items unit bytes time_ns ns_per_item items_per_s MB_per_s\n");
+	for(m=0; m<(int)(sizeof(Models)/sizeof(Models[0])); m++) {
+		for(o=0; o<(int)(sizeof(Occupancy)/sizeof(Occupancy[0])); o++) {
+			memset(&in, 0, sizeof(in));
+			if (MakeStream(&in, Models[m].model, Models[m].NumCh, Occupancy[o], Models[m].Tdc, nev) < 0) {
+				printf("# %s: can't allocate the data stream\n", Models[m].model);
+				continue;
+			}
+			RunInput(&in, dir);
+			free(in.words);
+		}
+	}
+	if (RawFile != NULL) {
+		memset(&in, 0, sizeof(in));
+		if (LoadStream(&in, RawFile, 16) < 0) {
+			printf("# can't read %s\n", RawFile);
+		} else {
+			RunInput(&in, dir);
+			free(in.words);
+		}
+	}
+	rmdir(dir);
+	return 0;
+}
@@ -0,0 +1,342 @@
+/******************************************************************************
+*
+* CAEN SpA - Front End Division
+* Via Vetraia, 11 - 55049 - Viareggio ITALY
+* +390594388398 - www.caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This program is free software; you can redistribute it and/or modify it under
+* the terms of the GNU General Public License as published by the Free Software
+* Foundation. This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "QTPD.h"
+
+#define MAX_BLT_SIZE		(256*1024)
+#define NUM_BLT_BUFFERS		8
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: default settings
+// ---------------------------------------------------------------------------------------------------------
+void QTPD_ConfigDefault(QTPD_Config *cfg)
+{
+	int i;
+
+	memset(cfg, 0, sizeof(QTPD_Config));
+	for(i=0; i<QTPD_MAX_LINKS; i++) {
+		cfg->Link[i].LinkType = cvV1718;
+		cfg->Link[i].Core = -1;
+	}
+	cfg->NumLinks = 1;
+	cfg->Iped = 255;
+	cfg->EnableSuppression = 1;
+	cfg->DiscrOutputWidth = 10;
+	for(i=0; i<16; i++)
+		cfg->DiscrThreshold[i] = 5;
+	cfg->DiscrScanStart = 1;
+	cfg->DiscrScanStop = 255;
+	cfg->DiscrScanStep = 4;
+	cfg->DiscrScanTime = 500;
+	cfg->LldTuneSigmas = 3.0;
+	cfg->LldTuneTime = 2000;
+	strcpy(cfg->DataPath, "./data/");
+	cfg->BltBufferCount = NUM_BLT_BUFFERS;
+	cfg->BltBufferSize = MAX_BLT_SIZE;
+	cfg->BltMinSize = BLT_MIN_SIZE_DEFAULT;
+	cfg->BltSweepStepTime = 2000;
+	cfg->TimerSource = TIMER_SOURCE_MONOTONIC;
+	cfg->RateWindow = 1000;
+	cfg->PedWindow = 10;
+	cfg->PedTrackDepth = 1000;
+	cfg->PeakHalfWidth = 20;
+	cfg->CalHistoBins = 4096;
+	cfg->CalHistoMin = 0;
+	cfg->CalHistoMax = 4096 * QTPD_LSB2PHY;
+	cfg->HistoBins = HISTO_MAX_BINS;
+	cfg->Hist2DMaxTiles = 1024;
+	cfg->StreamRingSize = 16*1024*1024;
+	cfg->StreamContent = STREAM_RAW | STREAM_EVENTS;
+	FilterCfg_Init(&cfg->Select);
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: read the value(s) of the parameter key from the config file
+// ---------------------------------------------------------------------------------------------------------
+void QTPD_ConfigParse(QTPD_Config *cfg, const char *str, FILE *f_ini)
+{
+	int i, data;
+	QTPD_LinkConfig *lk = &cfg->Link[cfg->NumLinks-1];	// settings of the last CONNECTION section
+
+	// Output Files
+	if (strstr(str, "ENABLE_LIST_FILE")!=NULL) fscanf(f_ini, "%d", &cfg->EnableListFile);
+	if (strstr(str, "ENABLE_HISTO_FILES")!=NULL) fscanf(f_ini, "%d", &cfg->EnableHistoFiles);
+	if (strstr(str, "ENABLE_RAW_DATA_FILE")!=NULL) fscanf(f_ini, "%d", &cfg->EnableRawDataFile);
+
+	// Base Addresses
+	if (strstr(str, "QTP_BASE_ADDRESS")!=NULL)
+		fscanf(f_ini, "%x", &lk->QTPBaseAddr);
+	if (strstr(str, "DISCR_BASE_ADDRESS")!=NULL)
+		fscanf(f_ini, "%x", &lk->DiscrBaseAddr);
+
+	// CPU core of the readout thread of the link
+	if (strstr(str, "READOUT_CORE")!=NULL)
+		fscanf(f_ini, "%d", &lk->Core);
+
+	// I-pedestal
+	if (strstr(str, "IPED")!=NULL) {
+		fscanf(f_ini, "%d", &data);
+		cfg->Iped = (uint16_t)data;
+	}
+
+	// Discr_ChannelMask
+	if (strstr(str, "DISCR_CHANNEL_MASK")!=NULL) {
+		fscanf(f_ini, "%x", &data);
+		cfg->DiscrChMask = (uint16_t)data;
+	}
+
+	// Discr_OutputWidth
+	if (strstr(str, "DISCR_OUTPUT_WIDTH")!=NULL) {
+		fscanf(f_ini, "%d", &data);
+		cfg->DiscrOutputWidth = (uint16_t)data;
+	}
+
+	// Discr_Threshold
+	if (strstr(str, "DISCR_THRESHOLD")!=NULL) {
+		int ch, thr;
+		fscanf(f_ini, "%d", &ch);
+		fscanf(f_ini, "%d", &thr);
+		if (ch < 0) {
+			for(i=0; i<16; i++)
+				cfg->DiscrThreshold[i] = thr;
+		} else if (ch < 16) {
+			cfg->DiscrThreshold[ch] = thr;
+		}
+	}
+
+	// Discriminator threshold scan
+	if (strstr(str, "DISCR_SCAN_MODE")!=NULL) {
+		char stringa[50];
+		fscanf(f_ini, "%s", stringa);
+		if (strcmp(stringa, "ALL") == 0)
+			cfg->DiscrScanMode = DISCR_SCAN_ALL;
+		else if (strcmp(stringa, "EACH") == 0)
+			cfg->DiscrScanMode = DISCR_SCAN_EACH;
+		else
+			cfg->DiscrScanMode = 0;
+	}
+	if (strstr(str, "DISCR_SCAN_RANGE")!=NULL) {
+		fscanf(f_ini, "%d", &cfg->DiscrScanStart);
+		fscanf(f_ini, "%d", &cfg->DiscrScanStop);
+		fscanf(f_ini, "%d", &cfg->DiscrScanStep);
+	}
+	if (strstr(str, "DISCR_SCAN_TIME")!=NULL) fscanf(f_ini, "%d", &cfg->DiscrScanTime);
+
+	// each CONNECTION after the first one opens a new link (the following
+	// base addresses and core belong to it). The bridge type is followed by
+	// the link number (or the PID / IP address) and by the conet node.
+	if (strstr(str, "CONNECTION") != NULL) {
+		char stringa[50], tail[100];
+
+		if (cfg->NumConnections > 0) {
+			if (cfg->NumLinks == QTPD_MAX_LINKS) {
+				printf("Too many connections (max %d)\n", QTPD_MAX_LINKS);
+				fscanf(f_ini, "%s", stringa);
+				return;
+			}
+			lk = &cfg->Link[cfg->NumLinks++];
+		}
+		cfg->NumConnections++;
+		fscanf(f_ini, "%s", stringa);
+		// link number and conet node are optional (default 0): read the rest of the line
+		if (fgets(tail, sizeof(tail), f_ini) == NULL)
+			tail[0] = 0;
+		lk->LinkPid = 0;
+		lk->ConetNode = 0;
+		if (strcmp(stringa, "usbV1718") == 0) {
+			lk->LinkType = cvV1718;
+		}
+		if (strcmp(stringa, "cpiV2718") == 0) {
+			lk->LinkType = cvV2718;
+		}
+		if (strcmp(stringa, "usbV3718") == 0) {
+			lk->LinkType = cvUSB_V3718;
+		}
+		if (strcmp(stringa, "pciV3718") == 0) {
+			lk->LinkType = cvPCI_A2818_V3718;
+		}
+		if (strcmp(stringa, "pciV4718") == 0) {
+			lk->LinkType = cvPCI_A2818_V4718;
+		}
+		if (strcmp(stringa, "usbV4718") == 0) {
+			lk->LinkType = cvUSB_V4718;
+		}
+		if (strcmp(stringa, "ethV4718") == 0) {
+			lk->LinkType = cvETH_V4718;
+			sscanf(tail, "%23s %d", lk->LinkIp, &lk->ConetNode);
+		}
+		if (strcmp(stringa, "usbA4818") == 0) {
+			lk->LinkType = cvUSB_A4818;
+		}
+		if (lk->LinkType != cvETH_V4718)
+			sscanf(tail, "%d %d", &lk->LinkPid, &lk->ConetNode);
+	}
+
+	// LLD for the QTP
+	if (strstr(str, "QTP_LLD")!=NULL) {
+		int ch, lld;
+		fscanf(f_ini, "%d", &ch);
+		fscanf(f_ini, "%d", &lld);
+		if (ch < 0) {
+			for(i=0; i<32; i++)
+				cfg->LLD[i] = lld;
+		} else if (ch < 32) {
+			cfg->LLD[ch] = lld;
+		}
+	}
+
+	// LLD tuning from a pedestal run
+	if (strstr(str, "LLD_TUNE_MODE")!=NULL) fscanf(f_ini, "%d", &cfg->LldTuneMode);
+	if (strstr(str, "LLD_TUNE_SIGMAS")!=NULL) fscanf(f_ini, "%f", &cfg->LldTuneSigmas);
+	if (strstr(str, "LLD_TUNE_TIME")!=NULL) fscanf(f_ini, "%d", &cfg->LldTuneTime);
+
+	// Zero and overflow suppression
+	if (strstr(str, "ENABLE_SUPPRESSION")!=NULL) {
+		fscanf(f_ini, "%d", &cfg->EnableSuppression);
+	}
+
+	// Software suppression
+	if (strstr(str, "SW_SUPPRESSION")!=NULL) fscanf(f_ini, "%d", &cfg->SwSuppression);
+	if (strstr(str, "SW_THRESHOLD")!=NULL) {
+		int ch, thr;
+		fscanf(f_ini, "%d", &ch);
+		fscanf(f_ini, "%d", &thr);
+		if (ch < 0) {
+			for(i=0; i<QTP_MAX_CH; i++)
+				cfg->SwThreshold[i] = thr;
+		} else if (ch < QTP_MAX_CH) {
+			cfg->SwThreshold[ch] = thr;
+		}
+	}
+	if (strstr(str, "SW_KEEP_OVERFLOW")!=NULL) fscanf(f_ini, "%d", &cfg->SwKeepOverflow);
+	if (strstr(str, "SW_SUPPRESS_HISTOS")!=NULL) fscanf(f_ini, "%d", &cfg->SwSuppressHistos);
+
+	// Readout buffers
+	if (strstr(str, "BLT_BUFFER_COUNT")!=NULL) fscanf(f_ini, "%d", &cfg->BltBufferCount);
+	if (strstr(str, "BLT_BUFFER_SIZE")!=NULL) {
+		fscanf(f_ini, "%d", &data);
+		cfg->BltBufferSize = data * 1024;
+	}
+	if (strstr(str, "BLT_BUFFER_HUGEPAGES")!=NULL) fscanf(f_ini, "%d", &cfg->BltHugePages);
+	if (strstr(str, "BLT_BUFFER_LOCK")!=NULL) fscanf(f_ini, "%d", &cfg->BltLockMemory);
+
+	// Block transfer size
+	if (strstr(str, "BLT_ADAPTIVE")!=NULL) fscanf(f_ini, "%d", &cfg->BltAdaptive);
+	if (strstr(str, "BLT_MIN_SIZE")!=NULL) fscanf(f_ini, "%d", &cfg->BltMinSize);
+	if (strstr(str, "BLT_SWEEP_MODE")!=NULL) fscanf(f_ini, "%d", &cfg->BltSweepMode);
+	if (strstr(str, "BLT_SWEEP_STEP_TIME")!=NULL) fscanf(f_ini, "%d", &cfg->BltSweepStepTime);
+
+	// Time stamps and rates
+	if (strstr(str, "TIMER_SOURCE")!=NULL) {
+		char stringa[50];
+		fscanf(f_ini, "%s", stringa);
+		if (strcmp(stringa, "TSC") == 0)
+			cfg->TimerSource = TIMER_SOURCE_TSC;
+		else
+			cfg->TimerSource = TIMER_SOURCE_MONOTONIC;
+	}
+	if (strstr(str, "RATE_WINDOW")!=NULL) fscanf(f_ini, "%d", &cfg->RateWindow);
+	if (strstr(str, "ENABLE_TIMESTAMPS")!=NULL) fscanf(f_ini, "%d", &cfg->EnableTimeStamps);
+
+	// Online statistics
+	if (strstr(str, "ENABLE_STATS_FILE")!=NULL) fscanf(f_ini, "%d", &cfg->EnableStatsFile);
+	if (strstr(str, "PED_WINDOW")!=NULL) fscanf(f_ini, "%d", &cfg->PedWindow);
+	if (strstr(str, "PED_TRACK_DEPTH")!=NULL) fscanf(f_ini, "%d", &cfg->PedTrackDepth);
+	if (strstr(str, "PEAK_HALF_WIDTH")!=NULL) fscanf(f_ini, "%d", &cfg->PeakHalfWidth);
+
+	// Calibration
+	if (strstr(str, "ENABLE_CALIBRATION")!=NULL) fscanf(f_ini, "%d", &cfg->EnableCalib);
+	if (strstr(str, "CALIB_FILE")!=NULL) fscanf(f_ini, "%s", cfg->CalibFileName);
+	if (strstr(str, "CALIB_HISTO_BINS")!=NULL) fscanf(f_ini, "%d", &cfg->CalHistoBins);
+	if (strstr(str, "CALIB_HISTO_MIN")!=NULL) fscanf(f_ini, "%f", &cfg->CalHistoMin);
+	if (strstr(str, "CALIB_HISTO_MAX")!=NULL) fscanf(f_ini, "%f", &cfg->CalHistoMax);
+
+	// 1D histograms
+	if (strstr(str, "HISTO_NUM_BINS")!=NULL) fscanf(f_ini, "%d", &cfg->HistoBins);
+
+	// Histogram fill threads
+	if (strstr(str, "FILL_THREADS")!=NULL) fscanf(f_ini, "%d", &cfg->FillThreads);
+
+	// 2D histograms (channel vs channel)
+	if (strstr(str, "HISTO2D_PAIR")!=NULL) {
+		int chx, chy, bins;
+		fscanf(f_ini, "%d", &chx);
+		fscanf(f_ini, "%d", &chy);
+		fscanf(f_ini, "%d", &bins);
+		if (cfg->NumHist2D < HIST2D_MAX_PAIRS) {
+			cfg->Hist2DPairs[cfg->NumHist2D][0] = chx;
+			cfg->Hist2DPairs[cfg->NumHist2D][1] = chy;
+			cfg->Hist2DPairs[cfg->NumHist2D][2] = bins;
+			cfg->NumHist2D++;
+		}
+	}
+	if (strstr(str, "HISTO2D_MAX_TILES")!=NULL) fscanf(f_ini, "%d", &cfg->Hist2DMaxTiles);
+
+	// Time-sliced histogram archive
+	if (strstr(str, "HISTO_ARCHIVE_INTERVAL")!=NULL) fscanf(f_ini, "%d", &cfg->HistoArchiveInterval);
+
+	// Event selection
+	FilterCfg_Parse(&cfg->Select, str, f_ini);
+
+	// Streaming server
+	if (strstr(str, "STREAM_SOCKET")!=NULL) fscanf(f_ini, "%s", cfg->StreamSocket);
+	if (strstr(str, "STREAM_TCP_PORT")!=NULL) fscanf(f_ini, "%d", &cfg->StreamTcpPort);
+	if (strstr(str, "STREAM_RING_SIZE")!=NULL) {
+		fscanf(f_ini, "%d", &data);
+		cfg->StreamRingSize = data * 1024;
+	}
+	if (strstr(str, "STREAM_DATA")!=NULL) {
+		char stringa[50];
+		fscanf(f_ini, "%s", stringa);
+		if (strcmp(stringa, "RAW") == 0)
+			cfg->StreamContent = STREAM_RAW;
+		else if (strcmp(stringa, "EVENTS") == 0)
+			cfg->StreamContent = STREAM_EVENTS;
+		else
+			cfg->StreamContent = STREAM_RAW | STREAM_EVENTS;
+	}
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: read the config file (on top of the current settings)
+// Return:		0=OK, -1=can't open the file
+// ---------------------------------------------------------------------------------------------------------
+int QTPD_ConfigLoad(QTPD_Config *cfg, const char *FileName)
+{
+	FILE *f_ini;
+
+	if ((f_ini = fopen(FileName, "r")) == NULL)
+		return -1;
+	while(!feof(f_ini)) {
+		char str[500];
+
+		str[0] = '#';
+		fscanf(f_ini, "%s", str);
+		if (str[0] == '#')
+			fgets(str, 500, f_ini);
+		else
+			QTPD_ConfigParse(cfg, str, f_ini);
+	}
+	fclose(f_ini);
+	return 0;
+}
@@ -0,0 +1,302 @@
+/******************************************************************************
+*
+* CAEN SpA - Front End Division
+* Via Vetraia, 11 - 55049 - Viareggio ITALY
+* +390594388398 - www.caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This program is free software; you can redistribute it and/or modify it under
+* the terms of the GNU General Public License as published by the Free Software
+* Foundation. This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "QTPD.h"
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: program thresholds and channel mask of the discriminator of a board in a single VME
+//              call and update the register image
+// Return:		0=OK, -1=VME error
+// ---------------------------------------------------------------------------------------------------------
+static int SetDiscr(QTPD_Board *b, const uint16_t Threshold[16], uint16_t ChMask)
+{
+	uint16_t addr[17], data[17];
+	int i, ret;
+
+	for(i=0; i<16; i++) {
+		addr[i] = i*2;
+		data[i] = Threshold[i];
+	}
+	addr[16] = 0x004A;
+	data[16] = ChMask;
+	b->BaseAddress = b->Link.DiscrBaseAddr;
+	ret = QTPD_WriteRegs(b, addr, data, 17);
+	b->BaseAddress = b->Link.QTPBaseAddr;
+	if (ret < 0) {
+		printf("%s", b->ErrorString);
+		b->VMEerror = 0;
+		return -1;
+	}
+	memcpy(b->Image.DiscrThreshold, Threshold, sizeof(b->Image.DiscrThreshold));
+	b->Image.DiscrChMask = ChMask;
+	return 0;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: triggers counted by the QTP board since the start of the run (24 bit event counter)
+// ---------------------------------------------------------------------------------------------------------
+static uint32_t ReadEventCounter(QTPD_Board *b)
+{
+	static const uint16_t addr[2] = {0x1024, 0x1026};  // Event Counter Low/High
+	uint16_t data[2];
+
+	if (QTPD_ReadRegs(b, addr, data, 2) < 0) {
+		b->VMEerror = 0;
+		return 0;
+	}
+	return data[0] | ((uint32_t)(data[1] & 0xFF) << 16);
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: start the run, read the blocks for ms milliseconds (counting events and bytes of each
+//              board) and stop it. t0 and t1 get the start and the end of the readout.
+// Return:		0=OK, -1=error
+// ---------------------------------------------------------------------------------------------------------
+static int RunFor(QTPD *q, int ms, uint64_t *nev, uint64_t *nbytes, uint64_t *t0, uint64_t *t1)
+{
+	memset(nev, 0, QTPD_MAX_LINKS * sizeof(uint64_t));
+	memset(nbytes, 0, QTPD_MAX_LINKS * sizeof(uint64_t));
+	if (QTPD_Start(q) < 0)
+		return -1;
+	*t0 = Timer_Now();
+	do {
+		const QTPD_View *v = QTPD_Read(q);
+		if (v != NULL) {
+			nev[v->Board] += v->NevInBlock;
+			nbytes[v->Board] += v->nwords * 4;
+			QTPD_Release(v);
+		}
+		*t1 = Timer_Now();
+	} while ((*t1 - *t0) < (uint64_t)ms * 1000000);
+	QTPD_Stop(q);
+	return 0;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: discriminator threshold scan. For each threshold from DiscrScanStart to DiscrScanStop
+//              (all the channels together or, with DISCR_SCAN_EACH, each enabled channel alone), the
+//              thresholds are written in one batch to the discriminators of all the links and the run is
+//              restarted for DiscrScanTime ms, measuring the rate of the events read, the rate of the
+//              triggers (QTP event counter) and the readout rate. Links, bridges and QTP settings stay
+//              in place; the run is left stopped, with the configured thresholds and with the
+//              histograms cleared. With a callback set, the blocks of the scan are not passed to it.
+//              StopReq (may be NULL) is called after each step: the scan ends
+//              when it returns non zero.
+// Return:		0=OK, -1=error
+// ---------------------------------------------------------------------------------------------------------
+int QTPD_DiscrScan(QTPD *q, FILE *fout, int (*StopReq)(void))
+{
+	QTPD_Config *c = &q->cfg;
+	QTPD_Callback cb;
+	uint16_t thr[16];
+	uint64_t nev[QTPD_MAX_LINKS], nbytes[QTPD_MAX_LINKS];
+	int i, k, ch, th, nch, nsteps, ndiscr = 0, quit = 0, ret = 0;
+
+	for(k=0; k<q->NumBoards; k++)
+		ndiscr += (q->Board[k]->Link.DiscrBaseAddr > 0);
+	if ((ndiscr == 0) || (c->DiscrScanStep <= 0) || (c->DiscrScanStart > c->DiscrScanStop)) {
+		printf("Discriminator scan: no discriminator or invalid range\n");
+		return -1;
+	}
+	QTPD_Stop(q);
+	cb = q->Callback;  // the scan reads the blocks itself
+	q->Callback = NULL;
+
+	nch = 0;
+	for(ch=0; ch<16; ch++)
+		nch += (c->DiscrChMask == 0) || (c->DiscrChMask & (1 << ch));
+	if (c->DiscrScanMode != DISCR_SCAN_EACH)
+		nch = 1;
+	nsteps = (c->DiscrScanStop - c->DiscrScanStart) / c->DiscrScanStep + 1;
+	printf("\nDiscriminator threshold scan: %d steps of %d ms (%s), about %.0f s\n", nsteps, c->DiscrScanTime,
+		nch > 1 ? "each channel" : "all channels", (double)nch * nsteps * c->DiscrScanTime / 1000.0);
+	printf("%6s %4s %6s %12s %12s %10s\n", "Board", "Ch", "Thr", "Events/s", "Triggers/s", "MB/s");
+	if (fout != NULL)
+		fprintf(fout, "# board ch threshold events_per_s triggers_per_s MB_per_s\n");
+
+	for(ch=(nch > 1 ? 0 : -1); (ch<16) && !quit; ch++) {
+		uint16_t mask = c->DiscrChMask;
+		if (ch >= 0) {
+			if ((c->DiscrChMask != 0) && !(c->DiscrChMask & (1 << ch)))
+				continue;
+			mask = (uint16_t)(1 << ch);
+		}
+		for(th=c->DiscrScanStart; (th<=c->DiscrScanStop) && !quit; th+=c->DiscrScanStep) {
+			uint64_t t0, t1, t2;
+
+			for(i=0; i<16; i++)
+				thr[i] = (ch < 0) || (i == ch) ? (uint16_t)th : c->DiscrThreshold[i];
+			for(k=0; k<q->NumBoards; k++) {
+				if ((q->Board[k]->Link.DiscrBaseAddr > 0) && (SetDiscr(q->Board[k], thr, mask) < 0))
+					ret = -1;
+			}
+			if (ret < 0)
+				break;
+
+			if ((ret = RunFor(q, c->DiscrScanTime, nev, nbytes, &t0, &t1)) < 0)
+				break;
+
+			for(k=0; k<q->NumBoards; k++) {
+				uint32_t ntrg = ReadEventCounter(q->Board[k]);
+				double sec, tsec;
+				t2 = Timer_Now();
+				sec = (t1 - t0) / 1e9;
+				tsec = (t2 - t0) / 1e9;  // the counter runs until it is read
+				printf("%6d %4d %6d %12.1f %12.1f %10.3f\n", k, ch, th, nev[k] / sec, ntrg / tsec,
+					nbytes[k] / (1024.0 * 1024.0) / sec);
+				if (fout != NULL)
+					fprintf(fout, "%d %d %d %.1f %.1f %.4f\n", k, ch, th, nev[k] / sec, ntrg / tsec,
+						nbytes[k] / (1024.0 * 1024.0) / sec);
+			}
+			if (fout != NULL)
+				fflush(fout);
+			if ((StopReq != NULL) && StopReq())
+				quit = 1;
+		}
+		if ((ret < 0) || (ch < 0))  // all the channels together: a single pass
+			break;
+	}
+
+	// back to the configured thresholds
+	for(k=0; k<q->NumBoards; k++) {
+		if ((q->Board[k]->Link.DiscrBaseAddr > 0) && (SetDiscr(q->Board[k], c->DiscrThreshold, c->DiscrChMask) < 0))
+			ret = -1;
+	}
+	QTPD_Reset(q);
+	q->Callback = cb;
+	return ret;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: write the LLD registers of all the channels of a board (register value = threshold / 16)
+//              in a single VME call and update the register image
+// Return:		0=OK, -1=VME error
+// ---------------------------------------------------------------------------------------------------------
+static int SetLLD(QTPD_Board *b, const uint16_t *LLDReg)
+{
+	uint16_t addr[QTP_MAX_CH];
+	int i;
+
+	for(i=0; i<b->NumCh; i++)
+		addr[i] = 0x1080 + i * (b->NumCh == 16 ? 4 : 2);
+	if (QTPD_WriteRegs(b, addr, LLDReg, b->NumCh) < 0) {
+		printf("%s", b->ErrorString);
+		b->VMEerror = 0;
+		return -1;
+	}
+	memcpy(b->Image.LLD, LLDReg, b->NumCh * sizeof(uint16_t));
+	return 0;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: LLD tuning. A pedestal run of LldTuneTime ms (no signals at the inputs) is taken with all
+//              the LLDs at 0; the pedestal and its sigma are fitted on the histogram of each channel and
+//              the LLD of the channel is set to the first multiple of 16 not below pedestal +
+//              LldTuneSigmas * sigma. The new LLDs are programmed and a second run of the same length
+//              measures the words per event read with them. The results of each board are saved in
+//              <prefix>V792nQDC_LLD.txt as QTP_LLD lines. The run is left stopped with the new LLDs
+//              programmed and the histograms cleared.
+// Return:		0=OK, -1=error
+// ---------------------------------------------------------------------------------------------------------
+int QTPD_TuneLLD(QTPD *q)
+{
+	QTPD_Config *c = &q->cfg;
+	QTPD_Callback cb;
+	uint16_t lld[QTPD_MAX_LINKS][QTP_MAX_CH];
+	uint64_t nev[2][QTPD_MAX_LINKS], nbytes[2][QTPD_MAX_LINKS], t0, t1;
+	int i, k, ret = 0;
+
+	QTPD_Stop(q);
+	cb = q->Callback;  // the tuning reads the blocks itself
+	q->Callback = NULL;
+	if (!c->EnableSuppression)
+		printf("Warning: ENABLE_SUPPRESSION is 0, the LLD thresholds have no effect on the data\n");
+	printf("\nLLD tuning: pedestal run of %d ms, LLD = pedestal + %.1f sigma\n", c->LldTuneTime, c->LldTuneSigmas);
+
+	// pedestal run with the LLDs at 0
+	memset(lld, 0, sizeof(lld));
+	for(k=0; (k<q->NumBoards) && (ret == 0); k++)
+		ret = SetLLD(q->Board[k], lld[k]);
+	QTPD_Reset(q);
+	if ((ret < 0) || (RunFor(q, c->LldTuneTime, nev[0], nbytes[0], &t0, &t1) < 0))
+		goto TuneEnd;
+
+	for(k=0; k<q->NumBoards; k++) {
+		QTPD_Board *b = q->Board[k];
+		FILE *fout;
+		char fname[255];
+
+		sprintf(fname, "%sV792nQDC_LLD.txt", b->Prefix);
+		if ((fout = fopen(fname, "w")) != NULL)
+			fprintf(fout, "# LLD = pedestal + %.1f sigma (%llu events, %d ms)\n", c->LldTuneSigmas,
+				(unsigned long long)nev[0][k], c->LldTuneTime);
+		if (q->NumBoards > 1)
+			printf("Link %d:\n", k);
+		printf("%4s %10s %8s %6s\n", "Ch", "Pedestal", "Sigma", "LLD");
+		for(i=0; i<b->NumCh; i++) {
+			double ped, sigma, thr;
+			if (Stats_FitPedestal(&b->histo, i, c->PedWindow, &ped, &sigma) == 0) {
+				printf("%4d %10s %8s %6d\n", i, "-", "-", 0);
+				if (fout != NULL)
+					fprintf(fout, "QTP_LLD %2d 0        # no data\n", i);
+				continue;
+			}
+			thr = (ped + c->LldTuneSigmas * sigma) / 16;
+			lld[k][i] = (uint16_t)(thr > 255 ? 255 : (thr > (int)thr ? (int)thr + 1 : (int)thr));
+			printf("%4d %10.2f %8.2f %6d\n", i, ped, sigma, lld[k][i] * 16);
+			if (fout != NULL)
+				fprintf(fout, "QTP_LLD %2d %-6d   # pedestal %.2f sigma %.2f\n", i, lld[k][i] * 16, ped, sigma);
+		}
+		if (fout != NULL) {
+			fclose(fout);
+			printf("LLD settings saved to %s\n", fname);
+		}
+		if (SetLLD(b, lld[k]) < 0)
+			ret = -1;
+	}
+	if (ret < 0)
+		goto TuneEnd;
+
+	// same run with the new LLDs
+	QTPD_Reset(q);
+	if (RunFor(q, c->LldTuneTime, nev[1], nbytes[1], &t0, &t1) < 0) {
+		ret = -1;
+		goto TuneEnd;
+	}
+	for(k=0; k<q->NumBoards; k++) {
+		double w0 = nev[0][k] > 0 ? nbytes[0][k] / 4.0 / nev[0][k] : 0;
+		double w1 = nev[1][k] > 0 ? nbytes[1][k] / 4.0 / nev[1][k] : 0;
+		if (q->NumBoards > 1)
+			printf("Link %d: ", k);
+		printf("words per event: %.2f with LLD = 0, %.2f with the tuned LLDs (%.1f%% less)\n", w0, w1,
+			w0 > 0 ? 100.0 * (w0 - w1) / w0 : 0.0);
+	}
+
+TuneEnd:
+	QTPD_Reset(q);
+	q->Callback = cb;
+	return ret;
+}
@@ -0,0 +1,298 @@
+/******************************************************************************
+*
+* CAEN SpA - Front End Division
+* Via Vetraia, 11 - 55049 - Viareggio ITALY
+* +390594388398 - www.caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This program is free software; you can redistribute it and/or modify it under
+* the terms of the GNU General Public License as published by the Free Software
+* Foundation. This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#include <string.h>
+#include <math.h>
+
+#include "Stats.h"
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: initialize the statistics engine. 'out' (may be NULL) receives one line per channel
+//              at every publication.
+// ---------------------------------------------------------------------------------------------------------
+void Stats_Init(Stats *st, int NumCh, double Lsb2Phy, int PedWindow, int PedDepth, int PeakHalfWidth, FILE *out)
+{
+	memset(st, 0, sizeof(Stats));
+	st->NumCh = NumCh < STATS_MAX_CH ? NumCh : STATS_MAX_CH;
+	st->Lsb2Phy = Lsb2Phy;
+	st->PedWindow = PedWindow > 0 ? PedWindow : 1;
+	st->PedDepth = PedDepth > 0 ? PedDepth : 1;
+	st->PeakHalfWidth = PeakHalfWidth > 0 ? PeakHalfWidth : 1;
+	st->out = out;
+	if (out != NULL)
+		fprintf(out, "# time_ns ch count mean rms pedestal ped_sigma peak_centroid mean_phy peak_phy (period values; 'END' = whole run)\n");
+	Stats_Reset(st);
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: clear sums, pedestals and peaks
+// ---------------------------------------------------------------------------------------------------------
+void Stats_Reset(Stats *st)
+{
+	int i;
+	memset(&st->Run, 0, sizeof(StatSums));
+	memset(&st->Period, 0, sizeof(StatSums));
+	for(i=0; i<STATS_MAX_CH; i++) {
+		st->PedValid[i] = 0;
+		st->Ped[i] = 0;
+		st->PedVar[i] = 0;
+		st->PeakMin[i] = 4096;
+		st->PeakBin[i] = -1;
+		st->PeakMax[i] = 0;
+	}
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: add one event. data[] holds one value per channel (STATS_NO_DATA if the channel is
+//              not in the event); histo must already contain the event (NULL = no peak search: the
+//              histograms are filled elsewhere and the peaks are found by Stats_FindPeaks).
+//              The sums are accumulated without branches over all the lanes; the pedestal and
+//              peak trackers only look at the channels present in the event.
+// ---------------------------------------------------------------------------------------------------------
+void Stats_AddEvent(Stats *st, const uint16_t *data, const HistoSet *histo)
+{
+	int i;
+
+	for(i=0; i<STATS_MAX_CH; i++) {
+		uint64_t m = (data[i] != STATS_NO_DATA);
+		uint64_t v = data[i] & 0xFFF;
+		st->Period.Count[i] += m;
+		st->Period.Sum[i] += m * v;
+		st->Period.SumSq[i] += m * v * v;
+	}
+
+	for(i=0; i<st->NumCh; i++) {
+		int v = data[i];
+		float d;
+		if (v == STATS_NO_DATA)
+			continue;
+		if (st->PedValid[i]) {
+			d = v - st->Ped[i];
+			if (fabsf(d) <= st->PedWindow) {
+				st->Ped[i] += d / st->PedDepth;
+				st->PedVar[i] += (d * d - st->PedVar[i]) / st->PedDepth;
+			}
+		}
+		if ((histo != NULL) && (v >= st->PeakMin[i])) {
+			uint64_t c = Histo_Get(histo, i, v);
+			if (c > st->PeakMax[i]) {
+				st->PeakMax[i] = c > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)c;
+				st->PeakBin[i] = v;
+			}
+		}
+	}
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: search the peaks in the whole histograms (above PeakMin), when the events are not
+//              added to them in order (fill threads)
+// ---------------------------------------------------------------------------------------------------------
+void Stats_FindPeaks(Stats *st, const HistoSet *histo)
+{
+	int i, ch;
+
+	for(ch=0; ch<st->NumCh; ch++) {
+		if (st->PeakMin[ch] > 4095)
+			continue;
+		for(i=st->PeakMin[ch]>>histo->Shift; i<histo->Bins; i++) {
+			uint64_t c = Histo_GetBin(histo, ch, i);
+			if (c > st->PeakMax[ch]) {
+				st->PeakMax[ch] = c > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)c;
+				st->PeakBin[ch] = (i << histo->Shift) > st->PeakMin[ch] ? i << histo->Shift : st->PeakMin[ch];
+			}
+		}
+	}
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: center of a bin in ADC units (the histograms can be rebinned)
+// ---------------------------------------------------------------------------------------------------------
+static double BinCenter(const HistoSet *h, int bin)
+{
+	return (double)(bin << h->Shift) + (double)((1 << h->Shift) - 1) / 2;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: highest bin of the histogram of a channel
+// ---------------------------------------------------------------------------------------------------------
+static int MaxBin(const HistoSet *h, int ch)
+{
+	int i, imax = 0;
+	uint64_t max = Histo_GetBin(h, ch, 0);
+
+	for(i=1; i<h->Bins; i++) {
+		uint64_t c = Histo_GetBin(h, ch, i);
+		if (c > max) {
+			max = c;
+			imax = i;
+		}
+	}
+	return imax;
+}
+
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: mean and rms of a set of sums
+// ---------------------------------------------------------------------------------------------------------
+static void MeanRms(StatSums *s, int ch, double *mean, double *rms)
+{
+	double m, var;
+	if (s->Count[ch] == 0) {
+		*mean = 0;
+		*rms = 0;
+		return;
+	}
+	m = (double)s->Sum[ch] / s->Count[ch];
+	var = (double)s->SumSq[ch] / s->Count[ch] - m * m;
+	*mean = m;
+	*rms = var > 0 ? sqrt(var) : 0;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: centroid of the histogram around the peak found by the incremental search
+// ---------------------------------------------------------------------------------------------------------
+static double PeakCentroid(Stats *st, const HistoSet *h, int ch)
+{
+	int i, lo, hi;
+	double n = 0, s = 0;
+
+	if (st->PeakBin[ch] < 0)
+		return 0;
+	lo = st->PeakBin[ch] - st->PeakHalfWidth;
+	hi = st->PeakBin[ch] + st->PeakHalfWidth;
+	if (lo < st->PeakMin[ch]) lo = st->PeakMin[ch];
+	if (hi > 4095) hi = 4095;
+	for(i=lo>>h->Shift; i<=(hi>>h->Shift); i++) {
+		double c = (double)Histo_GetBin(h, ch, i);
+		n += c;
+		s += c * BinCenter(h, i);
+	}
+	return n > 0 ? s / n : 0;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: seed the pedestal tracker of a channel from the highest bin of its histogram
+// ---------------------------------------------------------------------------------------------------------
+static void SeedPedestal(Stats *st, const HistoSet *h, int ch)
+{
+	int imax = (int)BinCenter(h, MaxBin(h, ch));
+	st->Ped[ch] = (float)imax;
+	st->PedVar[ch] = (float)(st->PedWindow * st->PedWindow) / 12;
+	st->PedValid[ch] = 1;
+	st->PeakMin[ch] = imax + st->PedWindow + 1;
+	st->PeakBin[ch] = -1;
+	st->PeakMax[ch] = 0;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: position and width of the pedestal of a histogram taken without signals: mean and rms
+//              of the bins around the highest one, in a window of +/- 3 sigma (at least +/- Window)
+//              refined a few times
+// Return:		counts in the final window (0 = empty histogram)
+// ---------------------------------------------------------------------------------------------------------
+uint64_t Stats_FitPedestal(const HistoSet *h, int ch, int Window, double *ped, double *sigma)
+{
+	int i, it, lo, hi, imax = MaxBin(h, ch);
+	double n = 0, m, s, s2, half = Window > 0 ? Window : 1;
+
+	m = BinCenter(h, imax);
+	*ped = 0;
+	*sigma = 0;
+	if (Histo_GetBin(h, ch, imax) == 0)
+		return 0;
+	for(it=0; it<4; it++) {
+		lo = (int)(m - half);
+		hi = (int)(m + half + 1);
+		if (lo < 0) lo = 0;
+		if (hi > 4095) hi = 4095;
+		n = s = s2 = 0;
+		for(i=lo>>h->Shift; i<=(hi>>h->Shift); i++) {
+			double c = (double)Histo_GetBin(h, ch, i), x = BinCenter(h, i);
+			n += c;
+			s += c * x;
+			s2 += c * x * x;
+		}
+		m = s / n;
+		*sigma = s2 / n - m * m > 0 ? sqrt(s2 / n - m * m) : 0;
+		half = 3 * *sigma > Window ? 3 * *sigma : Window;
+	}
+	*ped = m;
+	return (uint64_t)n;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: publish the statistics of the last period (and fold them into the run sums).
+//              At the end of the run the whole run values are written.
+// ---------------------------------------------------------------------------------------------------------
+void Stats_Publish(Stats *st, const HistoSet *histo, uint64_t time, int EndOfRun)
+{
+	int ch, i;
+
+	for(i=0; i<STATS_MAX_CH; i++) {
+		st->Run.Count[i] += st->Period.Count[i];
+		st->Run.Sum[i] += st->Period.Sum[i];
+		st->Run.SumSq[i] += st->Period.SumSq[i];
+	}
+
+	for(ch=0; ch<st->NumCh; ch++) {
+		StatSums *s = EndOfRun ? &st->Run : &st->Period;
+		double mean, rms, peak;
+		if (!st->PedValid[ch] && (st->Run.Count[ch] >= STATS_PED_MIN_COUNTS))
+			SeedPedestal(st, histo, ch);
+		if (st->out == NULL)
+			continue;
+		MeanRms(s, ch, &mean, &rms);
+		peak = PeakCentroid(st, histo, ch);
+		if (EndOfRun)
+			fprintf(st->out, "END ");
+		fprintf(st->out, "%llu %d %llu %.3f %.3f %.3f %.3f %.3f %.1f %.1f\n", (unsigned long long)time, ch,
+			(unsigned long long)s->Count[ch], mean, rms, st->Ped[ch], sqrt(st->PedVar[ch]), peak,
+			mean * st->Lsb2Phy, (peak > 0 ? peak - st->Ped[ch] : 0) * st->Lsb2Phy);
+	}
+	if (st->out != NULL)
+		fflush(st->out);
+	memset(&st->Period, 0, sizeof(StatSums));
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: print the run statistics of one channel on the screen
+// ---------------------------------------------------------------------------------------------------------
+void Stats_Print(Stats *st, const HistoSet *histo, int ch)
+{
+	double mean, rms, peak;
+	if ((ch < 0) || (ch >= st->NumCh))
+		return;
+	MeanRms(&st->Run, ch, &mean, &rms);
+	printf("Ch %d: mean = %.2f rms = %.2f", ch, mean, rms);
+	if (st->PedValid[ch])
+		printf("  pedestal = %.2f (sigma %.2f)", st->Ped[ch], sqrt(st->PedVar[ch]));
+	peak = PeakCentroid(st, histo, ch);
+	if (peak > 0)
+		printf("  peak = %.2f (%.0f phys. units above pedestal)", peak, (peak - st->Ped[ch]) * st->Lsb2Phy);
+	printf("\n");
+}
@@ -0,0 +1,404 @@
+/******************************************************************************
+*
+* CAEN SpA - Front End Division
+* Via Vetraia, 11 - 55049 - Viareggio ITALY
+* +390594388398 - www.caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This program is free software; you can redistribute it and/or modify it under
+* the terms of the GNU General Public License as published by the Free Software
+* Foundation. This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "Stream.h"
+
+#define POLL_TIMEOUT_MS		100
+
+#define PADDED(n)			(((uint64_t)(n) + 7) & ~(uint64_t)7)
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: copy to/from the ring at the absolute position pos (wrapping at the end)
+// ---------------------------------------------------------------------------------------------------------
+static void RingWrite(StreamServer *srv, uint64_t pos, const void *src, size_t len)
+{
+	size_t off = (size_t)(pos & (srv->Size - 1));
+	size_t n1 = len < srv->Size - off ? len : srv->Size - off;
+	memcpy(srv->Ring + off, src, n1);
+	if (n1 < len)
+		memcpy(srv->Ring, (const uint8_t *)src + n1, len - n1);
+}
+
+static void RingRead(StreamServer *srv, uint64_t pos, void *dst, size_t len)
+{
+	size_t off = (size_t)(pos & (srv->Size - 1));
+	size_t n1 = len < srv->Size - off ? len : srv->Size - off;
+	memcpy(dst, srv->Ring + off, n1);
+	if (n1 < len)
+		memcpy((uint8_t *)dst + n1, srv->Ring, len - n1);
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: append a record to the ring. The acquisition thread never waits for the clients: the
+//              record can overwrite the data that the server thread is sending to a slow client.
+//              Reserve is published before the ring is written, so that the server can check after
+//              each send whether the data it sent have been overwritten (see SendClient).
+// Return:		0=OK, -1=record dropped (too large for the ring)
+// ---------------------------------------------------------------------------------------------------------
+static int PutRecord(StreamServer *srv, int Type, int Board, uint64_t TimeStamp, const void *payload, uint32_t size)
+{
+	static const uint8_t zero[8] = {0};
+	StreamRecHeader hdr;
+	uint64_t start = srv->Head;
+	uint64_t end = start + sizeof(StreamRecHeader) + PADDED(size);
+
+	if ((end - start) > srv->Size / 2) {
+		srv->RecDropped++;
+		return -1;
+	}
+	__atomic_store_n(&srv->Reserve, end, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);  // Reserve is visible before any byte of the record
+	hdr.Type = (uint16_t)Type;
+	hdr.Board = (uint16_t)Board;
+	hdr.Size = size;
+	hdr.TimeStamp = TimeStamp;
+	RingWrite(srv, start, &hdr, sizeof(hdr));
+	RingWrite(srv, start + sizeof(hdr), payload, size);
+	RingWrite(srv, start + sizeof(hdr) + size, zero, PADDED(size) - size);
+	__atomic_store_n(&srv->Head, end, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&srv->Idle, __ATOMIC_SEQ_CST)) {
+		char c = 0;
+		if (write(srv->WakeFd[1], &c, 1) < 0) {
+			// the pipe is full: the server thread is already awake
+		}
+	}
+	return 0;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: append a readout block of a board to the stream
+// ---------------------------------------------------------------------------------------------------------
+void Stream_PutBlock(StreamServer *srv, int Board, const uint32_t *raw, int nwords, uint64_t TimeStamp)
+{
+	if (!(srv->Content & STREAM_RAW) || (nwords <= 0))
+		return;
+	PutRecord(srv, STREAM_REC_RAW, Board, TimeStamp, raw, nwords * sizeof(uint32_t));
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: append the selected events of a block of a board to the stream (one record, or more if they
+//              don't fit in the scratch buffer)
+// ---------------------------------------------------------------------------------------------------------
+void Stream_PutEvents(StreamServer *srv, int Board, const QTP_Event *ev, const int *sel, int nsel, uint64_t TimeStamp)
+{
+	int e, size = 0;
+
+	if (!(srv->Content & STREAM_EVENTS) || (nsel <= 0))
+		return;
+	for(e=0; e<nsel; e++) {
+		const QTP_Event *p = &ev[sel[e]];
+		int nch = __builtin_popcount(p->ChMask);
+		int len = (int)PADDED(sizeof(StreamEvent) + nch * sizeof(uint16_t));
+		StreamEvent *se;
+		uint16_t *val;
+		uint32_t mask = p->ChMask;
+
+		if (size + len > srv->ScratchSize) {
+			PutRecord(srv, STREAM_REC_EVENTS, Board, TimeStamp, srv->Scratch, size);
+			size = 0;
+		}
+		se = (StreamEvent *)(srv->Scratch + size);
+		se->EventNum = p->EventNum;
+		se->ChMask = p->ChMask;
+		se->TimeStamp = p->TimeStamp;
+		val = (uint16_t *)(se + 1);
+		while (mask) {
+			*val++ = p->Data[__builtin_ctz(mask)];
+			mask &= mask - 1;
+		}
+		memset(val, 0, srv->Scratch + size + len - (uint8_t *)val);
+		size += len;
+	}
+	if (size > 0)
+		PutRecord(srv, STREAM_REC_EVENTS, Board, TimeStamp, srv->Scratch, size);
+}
+
+
+static void CloseClient(StreamServer *srv, StreamClient *c)
+{
+	close(c->fd);
+	c->fd = -1;
+	srv->NumClients--;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: send the pending data of a client with one scatter-gather write from the ring.
+//              A client that falls behind by more than half the ring skips to the newest record;
+//              a client that loses part of a record already started is disconnected. The writer
+//              does not wait for the send: Reserve is checked again after it, and if the writer
+//              has overwritten the data being sent the client (which got them) is disconnected.
+// ---------------------------------------------------------------------------------------------------------
+static void SendClient(StreamServer *srv, StreamClient *c)
+{
+	uint64_t h = __atomic_load_n(&srv->Head, __ATOMIC_ACQUIRE);
+	uint64_t len, off;
+	struct iovec iov[2];
+	struct msghdr msg;
+	ssize_t n;
+
+	if (c->Cursor == h)
+		return;
+	if ((c->Cursor == c->RecEnd) && (h - c->Cursor > srv->Size / 2)) {
+		c->Dropped += h - c->Cursor;
+		c->Cursor = c->RecEnd = h;
+		return;
+	}
+
+	// data already overwritten: skip to the newest record (or drop the client)
+	if (__atomic_load_n(&srv->Reserve, __ATOMIC_SEQ_CST) - c->Cursor > srv->Size) {
+		if (c->Cursor == c->RecEnd) {
+			c->Dropped += h - c->Cursor;
+			c->Cursor = c->RecEnd = h;
+		} else {
+			srv->Disconnected++;
+			CloseClient(srv, c);
+		}
+		return;
+	}
+
+	len = h - c->Cursor;
+	if (len > STREAM_MAX_SEND)
+		len = STREAM_MAX_SEND;
+	off = c->Cursor & (srv->Size - 1);
+	iov[0].iov_base = srv->Ring + off;
+	iov[0].iov_len = len < srv->Size - off ? len : srv->Size - off;
+	iov[1].iov_base = srv->Ring;
+	iov[1].iov_len = len - iov[0].iov_len;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = iov[1].iov_len > 0 ? 2 : 1;
+	n = sendmsg(c->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+	if (n > 0) {
+		uint64_t start = c->Cursor;
+		c->Cursor += n;
+		c->Sent += n;
+		while (c->RecEnd < c->Cursor) {  // the headers are checked with the data below
+			StreamRecHeader hdr;
+			RingRead(srv, c->RecEnd, &hdr, sizeof(hdr));
+			c->RecEnd += sizeof(hdr) + PADDED(hdr.Size);
+		}
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&srv->Reserve, __ATOMIC_RELAXED) - start > srv->Size) {  // overrun during the send
+			srv->Disconnected++;
+			CloseClient(srv, c);
+			return;
+		}
+	}
+	if ((n < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+		CloseClient(srv, c);
+}
+
+
+static void AcceptClients(StreamServer *srv)
+{
+	int fd, i;
+
+	while ((fd = accept(srv->ListenFd, NULL, NULL)) >= 0) {
+		for(i=0; i<STREAM_MAX_CLIENTS; i++)
+			if (srv->Client[i].fd < 0)
+				break;
+		if (i == STREAM_MAX_CLIENTS) {
+			close(fd);
+			continue;
+		}
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		memset(&srv->Client[i], 0, sizeof(StreamClient));
+		srv->Client[i].fd = fd;
+		srv->Client[i].Cursor = srv->Client[i].RecEnd = __atomic_load_n(&srv->Head, __ATOMIC_ACQUIRE);
+		srv->NumClients++;
+	}
+}
+
+
+static void *ServerThread(void *arg)
+{
+	StreamServer *srv = (StreamServer *)arg;
+	struct pollfd pfd[STREAM_MAX_CLIENTS + 2];
+	int idx[STREAM_MAX_CLIENTS + 2];
+	int i, n;
+
+	while (!srv->Quit) {
+		uint64_t h;
+
+		__atomic_store_n(&srv->Idle, 1, __ATOMIC_SEQ_CST);
+		h = __atomic_load_n(&srv->Head, __ATOMIC_SEQ_CST);
+		pfd[0].fd = srv->ListenFd;
+		pfd[0].events = POLLIN;
+		pfd[1].fd = srv->WakeFd[0];
+		pfd[1].events = POLLIN;
+		n = 2;
+		for(i=0; i<STREAM_MAX_CLIENTS; i++) {
+			StreamClient *c = &srv->Client[i];
+			if (c->fd < 0)
+				continue;
+			pfd[n].fd = c->fd;
+			pfd[n].events = c->Cursor != h ? POLLIN | POLLOUT : POLLIN;
+			idx[n++] = i;
+		}
+		poll(pfd, n, POLL_TIMEOUT_MS);
+		__atomic_store_n(&srv->Idle, 0, __ATOMIC_SEQ_CST);
+
+		if (pfd[1].revents & POLLIN) {
+			char tmp[256];
+			while (read(srv->WakeFd[0], tmp, sizeof(tmp)) > 0);
+		}
+		if (pfd[0].revents & POLLIN)
+			AcceptClients(srv);
+		for(i=2; i<n; i++) {
+			StreamClient *c = &srv->Client[idx[i]];
+			if (pfd[i].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+				CloseClient(srv, c);
+				continue;
+			}
+			if (pfd[i].revents & POLLIN) {  // the clients are not expected to send anything
+				char tmp[256];
+				if (recv(c->fd, tmp, sizeof(tmp), MSG_DONTWAIT) == 0) {
+					CloseClient(srv, c);
+					continue;
+				}
+			}
+			SendClient(srv, c);
+		}
+	}
+	return NULL;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: open the listening socket (Unix domain if SocketPath is set, otherwise TCP on the
+//              loopback interface) and start the server thread. RingSize is rounded up to a power of 2.
+// Return:		0=OK, -1=error
+// ---------------------------------------------------------------------------------------------------------
+int Stream_Open(StreamServer *srv, const char *SocketPath, int TcpPort, int RingSize, int Content)
+{
+	int i;
+
+	memset(srv, 0, sizeof(StreamServer));
+	srv->ListenFd = srv->WakeFd[0] = srv->WakeFd[1] = -1;
+	srv->Content = Content;
+	for(i=0; i<STREAM_MAX_CLIENTS; i++)
+		srv->Client[i].fd = -1;
+	for(srv->Size = 4096; srv->Size < (uint64_t)RingSize; srv->Size *= 2);
+	srv->ScratchSize = (int)(srv->Size / 4);
+	srv->Ring = (uint8_t *)malloc(srv->Size);
+	srv->Scratch = (uint8_t *)malloc(srv->ScratchSize);
+	if ((srv->Ring == NULL) || (srv->Scratch == NULL))
+		goto OpenError;
+
+	if ((SocketPath != NULL) && (SocketPath[0] != 0)) {
+		struct sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strncpy(addr.sun_path, SocketPath, sizeof(addr.sun_path) - 1);
+		strncpy(srv->SocketPath, SocketPath, sizeof(srv->SocketPath) - 1);
+		unlink(SocketPath);
+		srv->ListenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if ((srv->ListenFd < 0) || (bind(srv->ListenFd, (struct sockaddr *)&addr, sizeof(addr)) < 0))
+			goto OpenError;
+	} else {
+		struct sockaddr_in addr;
+		int one = 1;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons((uint16_t)TcpPort);
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		srv->ListenFd = socket(AF_INET, SOCK_STREAM, 0);
+		if (srv->ListenFd < 0)
+			goto OpenError;
+		setsockopt(srv->ListenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if (bind(srv->ListenFd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+			goto OpenError;
+	}
+	if (listen(srv->ListenFd, STREAM_MAX_CLIENTS) < 0)
+		goto OpenError;
+	fcntl(srv->ListenFd, F_SETFL, fcntl(srv->ListenFd, F_GETFL) | O_NONBLOCK);
+	if (pipe(srv->WakeFd) < 0)
+		goto OpenError;
+	fcntl(srv->WakeFd[0], F_SETFL, fcntl(srv->WakeFd[0], F_GETFL) | O_NONBLOCK);
+	fcntl(srv->WakeFd[1], F_SETFL, fcntl(srv->WakeFd[1], F_GETFL) | O_NONBLOCK);
+	if (pthread_create(&srv->Thread, NULL, ServerThread, srv) != 0)
+		goto OpenError;
+	return 0;
+
+OpenError:
+	printf("Can't open the stream server socket\n");
+	srv->Thread = 0;
+	Stream_Close(srv);
+	return -1;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: print the number of subscribers and the sent/dropped data
+// ---------------------------------------------------------------------------------------------------------
+void Stream_PrintStats(StreamServer *srv, FILE *f)
+{
+	uint64_t sent = 0, dropped = 0;
+	int i;
+
+	if (srv->Ring == NULL)
+		return;
+	for(i=0; i<STREAM_MAX_CLIENTS; i++) {
+		sent += srv->Client[i].Sent;
+		dropped += srv->Client[i].Dropped;
+	}
+	fprintf(f, "Stream: %d clients, sent = %.2f MB, dropped = %.2f MB, disconnected = %llu\n", srv->NumClients,
+		sent / (1024.0 * 1024.0), dropped / (1024.0 * 1024.0), (unsigned long long)srv->Disconnected);
+}
+
+
+void Stream_Close(StreamServer *srv)
+{
+	int i;
+
+	if (srv->Size == 0)  // not open
+		return;
+	if (srv->Thread) {
+		char c = 0;
+		srv->Quit = 1;
+		if (write(srv->WakeFd[1], &c, 1) < 0) {
+			// the server thread wakes up at the poll timeout
+		}
+		pthread_join(srv->Thread, NULL);
+	}
+	for(i=0; i<STREAM_MAX_CLIENTS; i++)
+		if (srv->Client[i].fd >= 0) close(srv->Client[i].fd);
+	if (srv->ListenFd >= 0) close(srv->ListenFd);
+	if (srv->WakeFd[0] >= 0) close(srv->WakeFd[0]);
+	if (srv->WakeFd[1] >= 0) close(srv->WakeFd[1]);
+	if (srv->SocketPath[0] != 0) unlink(srv->SocketPath);
+	if (srv->Ring != NULL) free(srv->Ring);
+	if (srv->Scratch != NULL) free(srv->Scratch);
+	memset(srv, 0, sizeof(StreamServer));
+	srv->ListenFd = srv->WakeFd[0] = srv->WakeFd[1] = -1;
+}
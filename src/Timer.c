@@ -0,0 +1,186 @@
+/******************************************************************************
+*
+* CAEN SpA - Front End Division
+* Via Vetraia, 11 - 55049 - Viareggio ITALY
+* +390594388398 - www.caen.it
+*
+***************************************************************************//**
+* \note TERMS OF USE:
+* This program is free software; you can redistribute it and/or modify it under
+* the terms of the GNU General Public License as published by the Free Software
+* Foundation. This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. The user relies on the
+* software, documentation and results solely at his own risk.
+******************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+	#include <x86intrin.h>
+	#define HAVE_TSC	1
+#else
+	#define HAVE_TSC	0
+#endif
+
+#include "Timer.h"
+
+#define TSC_CALIB_TIME		50000000	// ns
+
+static int TimerSource = TIMER_SOURCE_MONOTONIC;
+static uint64_t TscBase = 0;			// TSC value at calibration
+static uint64_t NsBase = 0;				// monotonic time at calibration
+static uint64_t TscMult = 0;			// ns per tick, fixed point (32 fractional bits)
+static double TicksPerNs = 1.0;
+
+
+static uint64_t MonotonicNs()
+{
+	struct timespec ts;
+#ifdef CLOCK_MONOTONIC_RAW
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+#else
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: select the time source. The TSC is calibrated against the monotonic clock; if it
+//              is not available or runs below 1 GHz (the ns per tick would not fit the 32 bit
+//              fixed point multiplier of Timer_Now) the monotonic clock is used.
+// Return:		the time source actually in use
+// ---------------------------------------------------------------------------------------------------------
+int Timer_Init(int Source)
+{
+	TimerSource = TIMER_SOURCE_MONOTONIC;
+#if HAVE_TSC
+	if (Source == TIMER_SOURCE_TSC) {
+		uint64_t t0, t1, c0, c1;
+		t0 = MonotonicNs();
+		c0 = __rdtsc();
+		do {
+			t1 = MonotonicNs();
+		} while ((t1 - t0) < TSC_CALIB_TIME);
+		c1 = __rdtsc();
+		TicksPerNs = c1 > c0 ? (double)(c1 - c0) / (t1 - t0) : 0;
+		if (TicksPerNs > 1.0) {
+			TscMult = (uint64_t)((double)(1ULL << 32) / TicksPerNs);
+			TscBase = c1;
+			NsBase = t1;
+			TimerSource = TIMER_SOURCE_TSC;
+		} else {
+			printf("TSC not usable (%.3f GHz); using CLOCK_MONOTONIC_RAW\n", TicksPerNs);
+			TicksPerNs = 1.0;
+		}
+	}
+#endif
+	return TimerSource;
+}
+
+
+int Timer_Source()
+{
+	return TimerSource;
+}
+
+
+double Timer_TicksPerNs()
+{
+	return TimerSource == TIMER_SOURCE_TSC ? TicksPerNs : 1.0;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: get the monotonic time
+// Return:		time in ns (arbitrary origin)
+// ---------------------------------------------------------------------------------------------------------
+uint64_t Timer_Now()
+{
+#if HAVE_TSC
+	if (TimerSource == TIMER_SOURCE_TSC) {
+		uint64_t dt = __rdtsc() - TscBase;
+		// split the product to avoid the overflow of the 64 bit fixed point multiplication
+		return NsBase + (dt >> 32) * TscMult + (((dt & 0xFFFFFFFF) * TscMult) >> 32);
+	}
+#endif
+	return MonotonicNs();
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: initialize a rate meter with a window of WindowMs ms (10 buckets per window,
+//              or 100 ms buckets for long windows)
+// ---------------------------------------------------------------------------------------------------------
+void RateMeter_Init(RateMeter *rm, int WindowMs, uint64_t now)
+{
+	memset(rm, 0, sizeof(RateMeter));
+	if (WindowMs < 10)
+		WindowMs = 10;
+	rm->NumBuckets = 10;
+	if ((WindowMs / 100) > rm->NumBuckets)
+		rm->NumBuckets = (WindowMs / 100) < RATE_MAX_BUCKETS ? (WindowMs / 100) : RATE_MAX_BUCKETS;
+	rm->BucketWidth = (uint64_t)WindowMs * 1000000 / rm->NumBuckets;
+	rm->Start[0] = now;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: move to the bucket that contains 'now', clearing the buckets left behind
+// ---------------------------------------------------------------------------------------------------------
+static void RateMeter_Advance(RateMeter *rm, uint64_t now)
+{
+	uint64_t t;
+
+	if ((now - rm->Start[rm->Last]) >= rm->NumBuckets * rm->BucketWidth) {
+		// nothing added for a whole window: restart
+		t = now - (now - rm->Start[rm->Last]) % rm->BucketWidth;
+		memset(rm->Start, 0, sizeof(rm->Start));
+		memset(rm->Events, 0, sizeof(rm->Events));
+		memset(rm->Bytes, 0, sizeof(rm->Bytes));
+		rm->Last = 0;
+		rm->Start[0] = t;
+		return;
+	}
+	while ((now - rm->Start[rm->Last]) >= rm->BucketWidth) {
+		t = rm->Start[rm->Last] + rm->BucketWidth;
+		rm->Last = (rm->Last + 1) % rm->NumBuckets;
+		rm->Start[rm->Last] = t;
+		rm->Events[rm->Last] = 0;
+		rm->Bytes[rm->Last] = 0;
+	}
+}
+
+
+void RateMeter_Add(RateMeter *rm, uint64_t now, uint64_t nev, uint64_t nbytes)
+{
+	RateMeter_Advance(rm, now);
+	rm->Events[rm->Last] += nev;
+	rm->Bytes[rm->Last] += nbytes;
+}
+
+
+// ---------------------------------------------------------------------------------------------------------
+// Description: rates over the window that ends at 'now'
+// Return:		EventRate in Hz, ByteRate in bytes/s
+// ---------------------------------------------------------------------------------------------------------
+void RateMeter_Get(RateMeter *rm, uint64_t now, double *EventRate, double *ByteRate)
+{
+	uint64_t nev = 0, nb = 0, first;
+	int i;
+	double sec;
+
+	RateMeter_Advance(rm, now);
+	first = rm->Start[rm->Last];
+	for(i=0; i<rm->NumBuckets; i++) {
+		nev += rm->Events[i];
+		nb += rm->Bytes[i];
+		if ((rm->Start[i] != 0) && (rm->Start[i] < first))
+			first = rm->Start[i];
+	}
+	sec = (double)(now - first) / 1e9;
+	*EventRate = sec > 0 ? nev / sec : 0;
+	*ByteRate = sec > 0 ? nb / sec : 0;
+}